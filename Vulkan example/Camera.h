@@ -3,6 +3,9 @@
 typedef struct Camera
 {
   float fov = 90.0f;
+  // Depth range of the projection, draw sorting quantizes depth over the same range
+  float nearPlane = 1.0f;
+  float farPlane = 1500.0f;
   glm::vec3 position;
   glm::vec3 rotation;
   glm::vec3 scale = { 1,1,1 };
@@ -25,15 +28,18 @@ typedef struct Camera
 
   void MoveVector(glm::vec3 const& vec)
   {
+    dirty = true;
     position += vec;
   }
 
   void ScaleVector(glm::vec3 const& sca)
   {
+    dirty = true;
     scale += sca;
   }
   void RotateVector(glm::vec3 const& rot)
   {
+    dirty = true;
     rotation += rot;
   }
   void MoveCamera(glm::vec3  const& newPos)
@@ -0,0 +1,187 @@
+#include "CpuProfiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+
+namespace
+{
+  // Time spent in nested scopes of the innermost open scope on this thread
+  thread_local int64_t childTime = 0;
+}
+
+CpuProfiler& CpuProfiler::Get(void)
+{
+  static CpuProfiler profiler;
+  return profiler;
+}
+
+CpuProfiler::CpuProfiler(void)
+{
+  frameStart = std::chrono::steady_clock::now();
+  for (std::vector<double>& phase : window)
+    phase.resize(windowSize);
+}
+
+CpuProfiler::threadEvents* CpuProfiler::ThreadBuffer(void)
+{
+  // The registry lock is only taken the first time a thread records
+  thread_local threadEvents* buffer = nullptr;
+  if (buffer == nullptr)
+  {
+    std::lock_guard<std::mutex> guard(registryLock);
+    threads.push_back(std::make_unique<threadEvents>());
+    buffer = threads.back().get();
+  }
+  return buffer;
+}
+
+void CpuProfiler::Record(CpuPhase phase, int64_t nanoseconds)
+{
+  threadEvents* buffer = ThreadBuffer();
+  uint32_t head = buffer->head.load(std::memory_order_relaxed);
+  uint32_t next = (head + 1) % EventCapacity;
+  if (next == buffer->tail.load(std::memory_order_acquire))
+  {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer->events[head] = { phase, nanoseconds };
+  buffer->head.store(next, std::memory_order_release);
+}
+
+void CpuProfiler::EndFrame(void)
+{
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  frameTotals[PhaseFrame] = std::chrono::duration<double, std::milli>(now - frameStart).count();
+  frameStart = now;
+
+  {
+    std::lock_guard<std::mutex> guard(registryLock);
+    for (std::unique_ptr<threadEvents>& buffer : threads)
+    {
+      uint32_t tail = buffer->tail.load(std::memory_order_relaxed);
+      uint32_t head = buffer->head.load(std::memory_order_acquire);
+      for (; tail != head; tail = (tail + 1) % EventCapacity)
+      {
+        phaseEvent const& event = buffer->events[tail];
+        frameTotals[event.phase] += event.nanoseconds / 1000000.0;
+      }
+      buffer->tail.store(tail, std::memory_order_release);
+    }
+  }
+
+  for (int phase = 0; phase < CpuPhaseCount; ++phase)
+    window[phase][windowHead] = frameTotals[phase];
+  frameTotals = {};
+  windowHead = (windowHead + 1) % windowSize;
+  if (windowCount < windowSize)
+    ++windowCount;
+  ++frameCount;
+
+  if (dumpEvery != 0 && frameCount % dumpEvery == 0)
+  {
+    if (dumpPath.empty())
+    {
+      DumpText(std::cout);
+    }
+    else
+    {
+      // Written next to the target and renamed so readers never see half a file
+      std::string temporary = dumpPath + ".tmp";
+      {
+        std::ofstream file(temporary, std::ios_base::trunc);
+        DumpJson(file);
+      }
+      std::remove(dumpPath.c_str());
+      std::rename(temporary.c_str(), dumpPath.c_str());
+    }
+  }
+}
+
+cpuPhaseStats CpuProfiler::GetStats(CpuPhase phase) const
+{
+  cpuPhaseStats stats{};
+  stats.samples = windowCount;
+  if (windowCount == 0)
+    return stats;
+
+  std::vector<double> sorted(window[phase].begin(), window[phase].begin() + windowCount);
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&sorted](double p)
+    {
+      size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+      return sorted[index];
+    };
+  stats.p50 = percentile(0.50);
+  stats.p95 = percentile(0.95);
+  stats.p99 = percentile(0.99);
+  stats.max = sorted.back();
+  return stats;
+}
+
+void CpuProfiler::SetWindow(uint32_t frames)
+{
+  if (frames < 1)
+    frames = 1;
+  windowSize = frames;
+  windowHead = 0;
+  windowCount = 0;
+  for (std::vector<double>& phase : window)
+    phase.assign(windowSize, 0);
+}
+
+void CpuProfiler::SetPeriodicDump(uint32_t everyFrames, std::string const& path)
+{
+  dumpEvery = everyFrames;
+  dumpPath = path;
+}
+
+char const* CpuProfiler::PhaseName(CpuPhase phase)
+{
+  static char const* names[CpuPhaseCount] = { "frame", "fence_wait", "acquire", "upload", "record", "submit", "present" };
+  return names[phase];
+}
+
+void CpuProfiler::DumpText(std::ostream& out) const
+{
+  out << "CPU frame phases over " << windowCount << " frames (ms)\n";
+  out << std::left << std::setw(12) << "phase" << std::right
+    << std::setw(9) << "p50" << std::setw(9) << "p95" << std::setw(9) << "p99" << std::setw(9) << "max" << "\n";
+  out << std::fixed << std::setprecision(3);
+  for (int phase = 0; phase < CpuPhaseCount; ++phase)
+  {
+    cpuPhaseStats stats = GetStats(static_cast<CpuPhase>(phase));
+    out << std::left << std::setw(12) << PhaseName(static_cast<CpuPhase>(phase)) << std::right
+      << std::setw(9) << stats.p50 << std::setw(9) << stats.p95 << std::setw(9) << stats.p99 << std::setw(9) << stats.max << "\n";
+  }
+  out << std::defaultfloat;
+}
+
+void CpuProfiler::DumpJson(std::ostream& out) const
+{
+  out << "{\"frames\":" << windowCount << ",\"phases\":{";
+  for (int phase = 0; phase < CpuPhaseCount; ++phase)
+  {
+    cpuPhaseStats stats = GetStats(static_cast<CpuPhase>(phase));
+    out << (phase ? "," : "") << "\"" << PhaseName(static_cast<CpuPhase>(phase)) << "\":{"
+      << "\"p50\":" << stats.p50 << ",\"p95\":" << stats.p95 << ",\"p99\":" << stats.p99 << ",\"max\":" << stats.max << "}";
+  }
+  out << "}}\n";
+}
+
+ProfileScope::ProfileScope(CpuPhase p) : phase(p)
+{
+  parentChildTime = childTime;
+  childTime = 0;
+  start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope(void)
+{
+  int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  CpuProfiler::Get().Record(phase, elapsed - childTime);
+  // The enclosing scope doesn't count this one's time as its own
+  childTime = parentChildTime + elapsed;
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <ostream>
+#include <chrono>
+
+// The parts of a frame the CPU profiler tells apart
+enum CpuPhase
+{
+  PhaseFrame = 0,     // Whole frame, EndRenderPass to EndRenderPass
+  PhaseFenceWait,     // Waiting for the frame slot and swap image to retire
+  PhaseAcquire,       // vkAcquireNextImageKHR
+  PhaseUpload,        // Transient allocations, vertex/index copies and static uploads
+  PhaseRecord,        // Command recording, on every thread
+  PhaseSubmit,        // vkQueueSubmit
+  PhasePresent,       // vkQueuePresentKHR
+  CpuPhaseCount
+};
+
+typedef struct cpuPhaseStats
+{
+  double p50;          // Milliseconds
+  double p95;
+  double p99;
+  double max;
+  uint32_t samples;    // Frames in the window
+}cpuPhaseStats;
+
+/*
+ * Scoped CPU timing of the frame phases. Every thread writes into its own
+ * single producer ring, so recording a scope takes no lock. EndFrame drains
+ * the rings on the calling thread and keeps per frame phase totals over a
+ * sliding window of frames.
+ * Scopes are exclusive: time spent in a nested scope isn't counted again in
+ * the scope around it. Phase totals add up the time of every thread, so
+ * parallel work can make a phase longer than the frame.
+ */
+class CpuProfiler
+{
+public:
+  static CpuProfiler& Get(void);
+
+  // Closes the current frame, call once per frame from the thread that renders
+  void EndFrame(void);
+
+  cpuPhaseStats GetStats(CpuPhase phase) const;
+  void SetWindow(uint32_t frames);
+
+  void DumpText(std::ostream& out) const;
+  void DumpJson(std::ostream& out) const;
+  /*
+   * Dumps the stats every given number of frames, 0 turns it off.
+   * Text goes to stdout when path is empty, otherwise JSON is written to the file.
+   */
+  void SetPeriodicDump(uint32_t everyFrames, std::string const& path);
+
+  static char const* PhaseName(CpuPhase phase);
+
+  // Called by ProfileScope
+  void Record(CpuPhase phase, int64_t nanoseconds);
+
+private:
+  CpuProfiler(void);
+
+  static constexpr uint32_t EventCapacity = 4096;
+
+  typedef struct phaseEvent
+  {
+    CpuPhase phase;
+    int64_t nanoseconds;
+  }phaseEvent;
+
+  // Written by its thread only, read by EndFrame
+  typedef struct threadEvents
+  {
+    std::array<phaseEvent, EventCapacity> events;
+    std::atomic<uint32_t> head{ 0 };
+    std::atomic<uint32_t> tail{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+  }threadEvents;
+
+  threadEvents* ThreadBuffer(void);
+
+  mutable std::mutex registryLock;
+  std::vector<std::unique_ptr<threadEvents>> threads;
+
+  std::chrono::steady_clock::time_point frameStart;
+  std::array<double, CpuPhaseCount> frameTotals{};
+  // Ring of per frame totals for each phase
+  std::array<std::vector<double>, CpuPhaseCount> window;
+  uint32_t windowSize = 240;
+  uint32_t windowHead = 0;
+  uint32_t windowCount = 0;
+  uint64_t frameCount = 0;
+
+  uint32_t dumpEvery = 0;
+  std::string dumpPath;
+};
+
+// Times its lifetime as the given phase
+class ProfileScope
+{
+public:
+  explicit ProfileScope(CpuPhase phase);
+  ~ProfileScope(void);
+  ProfileScope(ProfileScope const&) = delete;
+  ProfileScope& operator=(ProfileScope const&) = delete;
+
+private:
+  CpuPhase phase;
+  std::chrono::steady_clock::time_point start;
+  int64_t parentChildTime;
+};
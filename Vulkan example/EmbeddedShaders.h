@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * SPIR-V compiled into the binary. Shaders/compile.bat runs as the pre-build
+ * step, so this always matches the GLSL being built. It writes every shader a
+ * second time with glslc -mfmt=c, which gives a brace enclosed list of words.
+ * Shaders whose .inc file doesn't exist yet are left out and get loaded from
+ * the pack or disk instead.
+ */
+typedef struct embeddedShader
+{
+  char const* name;
+  uint32_t const* code;
+  size_t size;   // Bytes
+}embeddedShader;
+
+#if __has_include("Shaders/vert.inc")
+inline constexpr uint32_t embeddedVert[] =
+#include "Shaders/vert.inc"
+;
+#define EMBED_VERT { "vert.spv", embeddedVert, sizeof(embeddedVert) },
+#else
+#define EMBED_VERT
+#endif
+
+#if __has_include("Shaders/frag.inc")
+inline constexpr uint32_t embeddedFrag[] =
+#include "Shaders/frag.inc"
+;
+#define EMBED_FRAG { "frag.spv", embeddedFrag, sizeof(embeddedFrag) },
+#else
+#define EMBED_FRAG
+#endif
+
+#if __has_include("Shaders/vert_instanced.inc")
+inline constexpr uint32_t embeddedVertInstanced[] =
+#include "Shaders/vert_instanced.inc"
+;
+#define EMBED_VERT_INSTANCED { "vert_instanced.spv", embeddedVertInstanced, sizeof(embeddedVertInstanced) },
+#else
+#define EMBED_VERT_INSTANCED
+#endif
+
+#if __has_include("Shaders/vert_indirect.inc")
+inline constexpr uint32_t embeddedVertIndirect[] =
+#include "Shaders/vert_indirect.inc"
+;
+#define EMBED_VERT_INDIRECT { "vert_indirect.spv", embeddedVertIndirect, sizeof(embeddedVertIndirect) },
+#else
+#define EMBED_VERT_INDIRECT
+#endif
+
+#if __has_include("Shaders/vert_depth.inc")
+inline constexpr uint32_t embeddedVertDepth[] =
+#include "Shaders/vert_depth.inc"
+;
+#define EMBED_VERT_DEPTH { "vert_depth.spv", embeddedVertDepth, sizeof(embeddedVertDepth) },
+#else
+#define EMBED_VERT_DEPTH
+#endif
+
+// Terminated by an entry with no name, so the table is never empty
+inline constexpr embeddedShader embeddedShaders[] =
+{
+  EMBED_VERT
+  EMBED_FRAG
+  EMBED_VERT_INSTANCED
+  EMBED_VERT_INDIRECT
+  EMBED_VERT_DEPTH
+  { nullptr, nullptr, 0 }
+};
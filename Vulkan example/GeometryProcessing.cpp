@@ -0,0 +1,388 @@
+#include "GeometryProcessing.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define GEOMETRY_SSE
+#endif
+
+// Bounds read positions as one flat float array
+static_assert(sizeof(glm::vec3) == 3 * sizeof(float), "glm::vec3 must be tightly packed");
+
+namespace
+{
+#if defined(__AVX__)
+  typedef __m256 lanes;
+  constexpr size_t Width = 8;
+  inline lanes Load(float const* p) { return _mm256_load_ps(p); }
+  inline lanes LoadUnaligned(float const* p) { return _mm256_loadu_ps(p); }
+  inline void Store(float* p, lanes v) { _mm256_store_ps(p, v); }
+  inline lanes Splat(float v) { return _mm256_set1_ps(v); }
+  inline lanes Add(lanes a, lanes b) { return _mm256_add_ps(a, b); }
+  inline lanes Sub(lanes a, lanes b) { return _mm256_sub_ps(a, b); }
+  inline lanes Mul(lanes a, lanes b) { return _mm256_mul_ps(a, b); }
+  inline lanes Div(lanes a, lanes b) { return _mm256_div_ps(a, b); }
+  inline lanes Min(lanes a, lanes b) { return _mm256_min_ps(a, b); }
+  inline lanes Max(lanes a, lanes b) { return _mm256_max_ps(a, b); }
+  inline lanes Sqrt(lanes v) { return _mm256_sqrt_ps(v); }
+  // 1 with the sign of v, -0 counts as negative
+  inline lanes SignOne(lanes v) { return _mm256_or_ps(_mm256_and_ps(v, _mm256_set1_ps(-0.0f)), _mm256_set1_ps(1.0f)); }
+#elif defined(GEOMETRY_SSE)
+  typedef __m128 lanes;
+  constexpr size_t Width = 4;
+  inline lanes Load(float const* p) { return _mm_load_ps(p); }
+  inline lanes LoadUnaligned(float const* p) { return _mm_loadu_ps(p); }
+  inline void Store(float* p, lanes v) { _mm_store_ps(p, v); }
+  inline lanes Splat(float v) { return _mm_set1_ps(v); }
+  inline lanes Add(lanes a, lanes b) { return _mm_add_ps(a, b); }
+  inline lanes Sub(lanes a, lanes b) { return _mm_sub_ps(a, b); }
+  inline lanes Mul(lanes a, lanes b) { return _mm_mul_ps(a, b); }
+  inline lanes Div(lanes a, lanes b) { return _mm_div_ps(a, b); }
+  inline lanes Min(lanes a, lanes b) { return _mm_min_ps(a, b); }
+  inline lanes Max(lanes a, lanes b) { return _mm_max_ps(a, b); }
+  inline lanes Sqrt(lanes v) { return _mm_sqrt_ps(v); }
+  inline lanes SignOne(lanes v) { return _mm_or_ps(_mm_and_ps(v, _mm_set1_ps(-0.0f)), _mm_set1_ps(1.0f)); }
+#else
+  typedef float lanes;
+  constexpr size_t Width = 1;
+  inline lanes Load(float const* p) { return *p; }
+  inline lanes LoadUnaligned(float const* p) { return *p; }
+  inline void Store(float* p, lanes v) { *p = v; }
+  inline lanes Splat(float v) { return v; }
+  inline lanes Add(lanes a, lanes b) { return a + b; }
+  inline lanes Sub(lanes a, lanes b) { return a - b; }
+  inline lanes Mul(lanes a, lanes b) { return a * b; }
+  inline lanes Div(lanes a, lanes b) { return a / b; }
+  inline lanes Min(lanes a, lanes b) { return std::min(a, b); }
+  inline lanes Max(lanes a, lanes b) { return std::max(a, b); }
+  inline lanes Sqrt(lanes v) { return std::sqrt(v); }
+  inline lanes SignOne(lanes v) { return std::copysign(1.0f, v); }
+#endif
+
+  // x, y and z of Width items
+  typedef struct soaBlock
+  {
+    alignas(32) float axis[3][Width];
+  }soaBlock;
+
+  // Slices smaller than this aren't worth handing to another thread
+  constexpr size_t MinItemsPerSlice = 16 * 1024;
+
+  // Workers are only ever waited on from outside the pool, so calls from any thread are safe
+  ThreadPool& Workers(void)
+  {
+    static ThreadPool pool;
+    static std::once_flag created;
+    std::call_once(created, []()
+      {
+        uint32_t threads = std::thread::hardware_concurrency();
+        pool.Create(threads > 1 ? threads : 0);
+      });
+    return pool;
+  }
+
+  // Calls body(begin, end) over slices of [0, count) in parallel, slices start on a block boundary
+  template<typename Body>
+  void ParallelFor(size_t count, Body const& body)
+  {
+    size_t slices = std::min<size_t>(Workers().GetThreadCount(), count / MinItemsPerSlice);
+    if (slices <= 1)
+    {
+      if (count)
+        body(size_t(0), count);
+      return;
+    }
+    size_t perSlice = (count + slices - 1) / slices;
+    perSlice = (perSlice + Width - 1) / Width * Width;
+    Workers().Dispatch(static_cast<uint32_t>(slices), [&](uint32_t slice)
+      {
+        size_t begin = slice * perSlice;
+        size_t end = std::min(count, begin + perSlice);
+        if (begin < end)
+          body(begin, end);
+      });
+  }
+
+  void Normalize(lanes& x, lanes& y, lanes& z)
+  {
+    // A zero vector stays zero instead of turning into NaNs
+    lanes length = Sqrt(Add(Add(Mul(x, x), Mul(y, y)), Mul(z, z)));
+    lanes inverse = Div(Splat(1.0f), Max(length, Splat(FLT_MIN)));
+    x = Mul(x, inverse);
+    y = Mul(y, inverse);
+    z = Mul(z, inverse);
+  }
+
+  /*
+   * Edge cross products of count triangles starting at first, twice as long as
+   * the triangle's area. indices may be null for non indexed meshes. Lanes past
+   * count and triangles referencing missing vertices come out zero.
+   */
+  void CrossTriangles(std::span<const glm::vec3> positions, uint32_t const* indices, size_t first, size_t count, bool normalize, soaBlock& out)
+  {
+    soaBlock corners[3];
+    for (size_t lane = 0; lane < Width; ++lane)
+    {
+      size_t vertex[3] = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+      if (lane < count)
+      {
+        for (int corner = 0; corner < 3; ++corner)
+          vertex[corner] = indices ? indices[(first + lane) * 3 + corner] : (first + lane) * 3 + corner;
+      }
+      bool valid = vertex[0] < positions.size() && vertex[1] < positions.size() && vertex[2] < positions.size();
+      for (int corner = 0; corner < 3; ++corner)
+      {
+        glm::vec3 p = valid ? positions[vertex[corner]] : glm::vec3(0.0f);
+        corners[corner].axis[0][lane] = p.x;
+        corners[corner].axis[1][lane] = p.y;
+        corners[corner].axis[2][lane] = p.z;
+      }
+    }
+
+    lanes ax = Load(corners[0].axis[0]), ay = Load(corners[0].axis[1]), az = Load(corners[0].axis[2]);
+    lanes e1x = Sub(Load(corners[1].axis[0]), ax), e1y = Sub(Load(corners[1].axis[1]), ay), e1z = Sub(Load(corners[1].axis[2]), az);
+    lanes e2x = Sub(Load(corners[2].axis[0]), ax), e2y = Sub(Load(corners[2].axis[1]), ay), e2z = Sub(Load(corners[2].axis[2]), az);
+    lanes x = Sub(Mul(e1y, e2z), Mul(e1z, e2y));
+    lanes y = Sub(Mul(e1z, e2x), Mul(e1x, e2z));
+    lanes z = Sub(Mul(e1x, e2y), Mul(e1y, e2x));
+    if (normalize)
+      Normalize(x, y, z);
+    Store(out.axis[0], x);
+    Store(out.axis[1], y);
+    Store(out.axis[2], z);
+  }
+
+  // Lanes past count are zero
+  void GatherVectors(glm::vec3 const* src, size_t count, soaBlock& out)
+  {
+    for (size_t lane = 0; lane < Width; ++lane)
+    {
+      glm::vec3 v = (lane < count) ? src[lane] : glm::vec3(0.0f);
+      out.axis[0][lane] = v.x;
+      out.axis[1][lane] = v.y;
+      out.axis[2][lane] = v.z;
+    }
+  }
+
+  /*
+   * Positions as a flat float array, Width vertices fill three registers and
+   * lane l of register r always holds axis (r * Width + l) % 3, so whole blocks
+   * are reduced without shuffling vertices apart first.
+   */
+  void MinMaxSlice(glm::vec3 const* positions, size_t count, glm::vec3& outMin, glm::vec3& outMax)
+  {
+    float const* floats = &positions[0].x;
+    lanes low[3] = { Splat(FLT_MAX), Splat(FLT_MAX), Splat(FLT_MAX) };
+    lanes high[3] = { Splat(-FLT_MAX), Splat(-FLT_MAX), Splat(-FLT_MAX) };
+    size_t blocks = count / Width;
+    for (size_t block = 0; block < blocks; ++block)
+    {
+      float const* src = floats + block * 3 * Width;
+      for (int r = 0; r < 3; ++r)
+      {
+        lanes v = LoadUnaligned(src + r * Width);
+        low[r] = Min(low[r], v);
+        high[r] = Max(high[r], v);
+      }
+    }
+
+    outMin = glm::vec3(FLT_MAX);
+    outMax = glm::vec3(-FLT_MAX);
+    soaBlock lowLanes, highLanes;
+    for (int r = 0; r < 3; ++r)
+    {
+      Store(lowLanes.axis[r], low[r]);
+      Store(highLanes.axis[r], high[r]);
+    }
+    for (size_t r = 0; r < 3; ++r)
+    {
+      for (size_t lane = 0; lane < Width; ++lane)
+      {
+        size_t axis = (r * Width + lane) % 3;
+        outMin[static_cast<int>(axis)] = std::min(outMin[static_cast<int>(axis)], lowLanes.axis[r][lane]);
+        outMax[static_cast<int>(axis)] = std::max(outMax[static_cast<int>(axis)], highLanes.axis[r][lane]);
+      }
+    }
+    for (size_t i = blocks * Width; i < count; ++i)
+    {
+      outMin = glm::min(outMin, positions[i]);
+      outMax = glm::max(outMax, positions[i]);
+    }
+  }
+
+  float MaxDistanceSquared(glm::vec3 const* positions, size_t count, glm::vec3 const& center)
+  {
+    lanes cx = Splat(center.x), cy = Splat(center.y), cz = Splat(center.z);
+    lanes farthest = Splat(0.0f);
+    soaBlock block;
+    for (size_t i = 0; i < count; i += Width)
+    {
+      // Lanes past the end sit on the center and add nothing
+      size_t valid = std::min(Width, count - i);
+      GatherVectors(positions + i, valid, block);
+      for (size_t lane = valid; lane < Width; ++lane)
+      {
+        block.axis[0][lane] = center.x;
+        block.axis[1][lane] = center.y;
+        block.axis[2][lane] = center.z;
+      }
+      lanes dx = Sub(Load(block.axis[0]), cx);
+      lanes dy = Sub(Load(block.axis[1]), cy);
+      lanes dz = Sub(Load(block.axis[2]), cz);
+      farthest = Max(farthest, Add(Add(Mul(dx, dx), Mul(dy, dy)), Mul(dz, dz)));
+    }
+    alignas(32) float result[Width];
+    Store(result, farthest);
+    return *std::max_element(result, result + Width);
+  }
+}
+
+void ComputeFaceNormals(std::span<const glm::vec3> positions, std::span<glm::vec3> normals)
+{
+  size_t triangles = std::min(positions.size(), normals.size()) / 3;
+  ParallelFor(triangles, [&](size_t begin, size_t end)
+    {
+      soaBlock face;
+      for (size_t first = begin; first < end; first += Width)
+      {
+        size_t count = std::min(Width, end - first);
+        CrossTriangles(positions, nullptr, first, count, true, face);
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+          glm::vec3 n(face.axis[0][lane], face.axis[1][lane], face.axis[2][lane]);
+          glm::vec3* dst = &normals[(first + lane) * 3];
+          dst[0] = n;
+          dst[1] = n;
+          dst[2] = n;
+        }
+      }
+    });
+}
+
+void ComputeSmoothNormals(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, std::span<glm::vec3> normals)
+{
+  size_t triangles = indices.size() / 3;
+  size_t vertexCount = std::min(positions.size(), normals.size());
+
+  // Area weighted face normals
+  std::vector<glm::vec3> faces(triangles);
+  ParallelFor(triangles, [&](size_t begin, size_t end)
+    {
+      soaBlock face;
+      for (size_t first = begin; first < end; first += Width)
+      {
+        size_t count = std::min(Width, end - first);
+        CrossTriangles(positions.first(vertexCount), indices.data(), first, count, false, face);
+        for (size_t lane = 0; lane < count; ++lane)
+          faces[first + lane] = glm::vec3(face.axis[0][lane], face.axis[1][lane], face.axis[2][lane]);
+      }
+    });
+
+  // The faces around each vertex, so vertices can be summed independently of each other
+  std::vector<uint32_t> firstFace(vertexCount + 1, 0);
+  for (size_t i = 0; i < triangles * 3; ++i)
+  {
+    if (indices[i] < vertexCount)
+      ++firstFace[indices[i] + 1];
+  }
+  for (size_t v = 0; v < vertexCount; ++v)
+    firstFace[v + 1] += firstFace[v];
+  std::vector<uint32_t> adjacent(firstFace[vertexCount]);
+  std::vector<uint32_t> cursor(firstFace.begin(), firstFace.end() - 1);
+  for (size_t i = 0; i < triangles * 3; ++i)
+  {
+    if (indices[i] < vertexCount)
+      adjacent[cursor[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  ParallelFor(vertexCount, [&](size_t begin, size_t end)
+    {
+      soaBlock sum;
+      for (size_t first = begin; first < end; first += Width)
+      {
+        size_t count = std::min(Width, end - first);
+        for (size_t lane = 0; lane < Width; ++lane)
+        {
+          glm::vec3 total(0.0f);
+          if (lane < count)
+          {
+            for (uint32_t f = firstFace[first + lane]; f < firstFace[first + lane + 1]; ++f)
+              total += faces[adjacent[f]];
+          }
+          sum.axis[0][lane] = total.x;
+          sum.axis[1][lane] = total.y;
+          sum.axis[2][lane] = total.z;
+        }
+
+        lanes x = Load(sum.axis[0]), y = Load(sum.axis[1]), z = Load(sum.axis[2]);
+        Normalize(x, y, z);
+        Store(sum.axis[0], x);
+        Store(sum.axis[1], y);
+        Store(sum.axis[2], z);
+        for (size_t lane = 0; lane < count; ++lane)
+          normals[first + lane] = glm::vec3(sum.axis[0][lane], sum.axis[1][lane], sum.axis[2][lane]);
+      }
+    });
+}
+
+void ComputeTangents(std::span<const glm::vec3> normals, std::span<glm::vec4> tangents)
+{
+  size_t vertexCount = std::min(normals.size(), tangents.size());
+  ParallelFor(vertexCount, [&](size_t begin, size_t end)
+    {
+      soaBlock n, t;
+      for (size_t first = begin; first < end; first += Width)
+      {
+        size_t count = std::min(Width, end - first);
+        GatherVectors(&normals[first], count, n);
+        lanes x = Load(n.axis[0]), y = Load(n.axis[1]), z = Load(n.axis[2]);
+
+        // sign + z never gets near zero, so the basis has no singularity
+        lanes sign = SignOne(z);
+        lanes a = Div(Splat(-1.0f), Add(sign, z));
+        Store(t.axis[0], Add(Splat(1.0f), Mul(Mul(sign, Mul(x, x)), a)));
+        Store(t.axis[1], Mul(sign, Mul(Mul(x, y), a)));
+        Store(t.axis[2], Sub(Splat(0.0f), Mul(sign, x)));
+        for (size_t lane = 0; lane < count; ++lane)
+          tangents[first + lane] = glm::vec4(t.axis[0][lane], t.axis[1][lane], t.axis[2][lane], 1.0f);
+      }
+    });
+}
+
+meshBounds ComputeBounds(std::span<const glm::vec3> positions)
+{
+  meshBounds bounds{};
+  if (positions.empty())
+    return bounds;
+
+  std::mutex merge;
+  bounds.min = glm::vec3(FLT_MAX);
+  bounds.max = glm::vec3(-FLT_MAX);
+  ParallelFor(positions.size(), [&](size_t begin, size_t end)
+    {
+      glm::vec3 sliceMin, sliceMax;
+      MinMaxSlice(&positions[begin], end - begin, sliceMin, sliceMax);
+      std::lock_guard<std::mutex> guard(merge);
+      bounds.min = glm::min(bounds.min, sliceMin);
+      bounds.max = glm::max(bounds.max, sliceMax);
+    });
+
+  bounds.center = (bounds.min + bounds.max) * 0.5f;
+  float farthest = 0.0f;
+  ParallelFor(positions.size(), [&](size_t begin, size_t end)
+    {
+      float slice = MaxDistanceSquared(&positions[begin], end - begin, bounds.center);
+      std::lock_guard<std::mutex> guard(merge);
+      farthest = std::max(farthest, slice);
+    });
+  bounds.radius = std::sqrt(farthest);
+  return bounds;
+}
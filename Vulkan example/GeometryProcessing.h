@@ -0,0 +1,43 @@
+#pragma once
+#include "glm/glm.hpp"
+#include <cstdint>
+#include <span>
+
+// Axis aligned box, and a sphere around its center enclosing every point
+typedef struct meshBounds
+{
+  glm::vec3 min;
+  glm::vec3 max;
+  glm::vec3 center;
+  float radius;
+}meshBounds;
+
+/*
+ * Bulk processing of geometry kept as separate streams. Triangles and vertices
+ * are gathered into SoA blocks as wide as the SIMD registers the build targets
+ * (8 with AVX, which the x64 builds enable, 4 with SSE) and processed a block
+ * at a time. Meshes large
+ * enough are split across a pool of worker threads owned by this module.
+ * These may be called from any thread.
+ */
+
+// One unit normal per triangle of a non indexed mesh, written to all three of its vertices
+void ComputeFaceNormals(std::span<const glm::vec3> positions, std::span<glm::vec3> normals);
+
+/*
+ * Smooth unit normals for an indexed mesh, each the average of the faces around
+ * the vertex weighted by their area. Vertices no triangle uses get zero, triangles
+ * with an index out of range are ignored.
+ */
+void ComputeSmoothNormals(std::span<const glm::vec3> positions, std::span<const uint32_t> indices, std::span<glm::vec3> normals);
+
+/*
+ * A unit tangent perpendicular to each unit normal, with w = 1.
+ * Vertices carry no texture coordinates, so the frame is the continuous
+ * orthonormal basis of the normal (Duff et al. 2017) rather than UV aligned.
+ * That basis is always right handed, the bitangent is cross(normal, tangent.xyz).
+ */
+void ComputeTangents(std::span<const glm::vec3> normals, std::span<glm::vec4> tangents);
+
+// Bounds of every position, all zero for none
+meshBounds ComputeBounds(std::span<const glm::vec3> positions);
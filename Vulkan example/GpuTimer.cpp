@@ -0,0 +1,155 @@
+#include "GpuTimer.h"
+
+// The render pass itself takes the first pair of every slot
+constexpr uint32_t RenderPassQueries = 2;
+
+GpuTimer::GpuTimer(void)
+{
+  device = VK_NULL_HANDLE;
+  pool = VK_NULL_HANDLE;
+  period = 1;
+  validMask = ~uint64_t(0);
+  queriesPerFrame = 0;
+  currentSlot = 0;
+  latest = {};
+}
+
+void GpuTimer::Create(VkDevice dev, VkPhysicalDevice physical, uint32_t queueFamily, uint32_t frameCount, uint32_t maxScopes)
+{
+  device = dev;
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical, &familyCount, families.data());
+  if (queueFamily >= familyCount || families[queueFamily].timestampValidBits == 0)
+    return;
+
+  uint32_t validBits = families[queueFamily].timestampValidBits;
+  validMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(physical, &properties);
+  period = properties.limits.timestampPeriod;
+
+  queriesPerFrame = RenderPassQueries + maxScopes * 2;
+  VkQueryPoolCreateInfo poolCreate{};
+  poolCreate.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  poolCreate.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  poolCreate.queryCount = queriesPerFrame * frameCount;
+  if (vkCreateQueryPool(device, &poolCreate, nullptr, &pool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create timestamp query pool!");
+
+  slots = std::vector<slotData>(frameCount);
+  // Every query reads back as a value and availability pair
+  results.resize(queriesPerFrame * 2);
+}
+
+void GpuTimer::Destroy(void)
+{
+  if (pool)
+    vkDestroyQueryPool(device, pool, nullptr);
+  pool = VK_NULL_HANDLE;
+}
+
+void GpuTimer::BeginFrame(VkCommandBuffer buffer, uint32_t frame, uint64_t frameNumber)
+{
+  if (pool == VK_NULL_HANDLE)
+    return;
+  currentSlot = frame;
+  slotData& slot = slots[currentSlot];
+  if (slot.pending)
+    Collect(slot);
+
+  vkCmdResetQueryPool(buffer, pool, queriesPerFrame * currentSlot, queriesPerFrame);
+  slot.frameNumber = frameNumber;
+  slot.used = RenderPassQueries;
+  slot.scopes.clear();
+  openScopes.clear();
+}
+
+void GpuTimer::EndFrame(void)
+{
+  if (pool == VK_NULL_HANDLE)
+    return;
+  slots[currentSlot].pending = true;
+}
+
+void GpuTimer::BeginRenderPass(VkCommandBuffer buffer)
+{
+  if (pool)
+    vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, queriesPerFrame * currentSlot);
+}
+
+void GpuTimer::EndRenderPass(VkCommandBuffer buffer)
+{
+  if (pool)
+    vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, queriesPerFrame * currentSlot + 1);
+}
+
+void GpuTimer::BeginScope(VkCommandBuffer buffer, char const* label)
+{
+  if (pool == VK_NULL_HANDLE)
+    return;
+  slotData& slot = slots[currentSlot];
+  // A dropped scope still gets pushed so its EndScope pairs up
+  if (slot.used + 2 > queriesPerFrame)
+  {
+    openScopes.push_back(UINT32_MAX);
+    return;
+  }
+
+  openScopes.push_back(static_cast<uint32_t>(slot.scopes.size()));
+  slot.scopes.push_back({ label, static_cast<uint32_t>(openScopes.size() - 1), slot.used });
+  vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pool, queriesPerFrame * currentSlot + slot.used);
+  slot.used += 2;
+}
+
+void GpuTimer::EndScope(VkCommandBuffer buffer)
+{
+  if (pool == VK_NULL_HANDLE || openScopes.empty())
+    return;
+  uint32_t scope = openScopes.back();
+  openScopes.pop_back();
+  if (scope == UINT32_MAX)
+    return;
+  slotData& slot = slots[currentSlot];
+  vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, queriesPerFrame * currentSlot + slot.scopes[scope].query + 1);
+}
+
+void GpuTimer::Collect(slotData& slot)
+{
+  slot.pending = false;
+  /*
+   * The slot's frame has completed, so this returns without waiting. A scope
+   * left open never wrote its end query, which then reads back unavailable and
+   * makes the call return VK_NOT_READY. Only that scope is dropped.
+   */
+  VkResult result = vkGetQueryPoolResults(device, pool, queriesPerFrame * currentSlot, slot.used,
+    sizeof(uint64_t) * 2 * slot.used, results.data(), sizeof(uint64_t) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (result != VK_SUCCESS && result != VK_NOT_READY)
+    return;
+
+  auto available = [this](uint32_t begin)
+    {
+      return results[begin * 2 + 1] != 0 && results[begin * 2 + 3] != 0;
+    };
+  auto elapsed = [this](uint32_t begin)
+    {
+      uint64_t ticks = (results[begin * 2 + 2] - results[begin * 2]) & validMask;
+      return static_cast<double>(ticks) * period / 1000000.0;
+    };
+
+  latest.frame = slot.frameNumber;
+  latest.renderPassMilliseconds = available(0) ? elapsed(0) : 0.0;
+  latest.scopes.clear();
+  for (scopeRecord const& scope : slot.scopes)
+  {
+    if (available(scope.query))
+      latest.scopes.push_back({ scope.label, scope.depth, elapsed(scope.query) });
+  }
+
+  history.push_back(latest);
+  while (history.size() > historyLength)
+    history.pop_front();
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+
+typedef struct gpuScopeTiming
+{
+  std::string label;
+  uint32_t depth;       // Nesting level, 0 for top level scopes
+  double milliseconds;
+}gpuScopeTiming;
+
+// GPU time of one finished frame
+typedef struct gpuFrameTiming
+{
+  uint64_t frame;                      // Frame number the timings were recorded in
+  double renderPassMilliseconds;       // Begin to end of the whole render pass, 0 if it never ended
+  std::vector<gpuScopeTiming> scopes;  // In the order they were opened, scopes left open are missing
+}gpuFrameTiming;
+
+/*
+ * Timestamp queries split into a range per frame in flight. A frame's queries
+ * are read back when its slot comes around again, after the slot's last frame
+ * completed, so reading them never stalls. Results are N frames late where N is
+ * the number of frames in flight.
+ */
+class GpuTimer
+{
+public:
+  GpuTimer(void);
+
+  // Does nothing if the queue family can't write timestamps
+  void Create(VkDevice device, VkPhysicalDevice physical, uint32_t queueFamily, uint32_t frameCount, uint32_t maxScopes);
+  void Destroy(void);
+  bool IsSupported(void) const { return pool != VK_NULL_HANDLE; }
+
+  /*
+   * Collects the results the slot holds from its last use and resets its queries.
+   * The slot's frame must have completed. Must be recorded outside of a render pass.
+   */
+  void BeginFrame(VkCommandBuffer buffer, uint32_t frame, uint64_t frameNumber);
+  void EndFrame(void);
+
+  void BeginRenderPass(VkCommandBuffer buffer);
+  void EndRenderPass(VkCommandBuffer buffer);
+
+  // Scopes nest, scopes past maxScopes in a frame are dropped
+  void BeginScope(VkCommandBuffer buffer, char const* label);
+  void EndScope(VkCommandBuffer buffer);
+
+  // Most recent frame that finished on the GPU
+  gpuFrameTiming const& GetLatest(void) const { return latest; }
+  std::deque<gpuFrameTiming> const& GetHistory(void) const { return history; }
+  void SetHistoryLength(size_t frames) { historyLength = frames; }
+
+private:
+  typedef struct scopeRecord
+  {
+    std::string label;
+    uint32_t depth;
+    uint32_t query;    // First of the begin/end pair
+  }scopeRecord;
+
+  typedef struct slotData
+  {
+    bool pending;      // Written and submitted, results not collected yet
+    uint64_t frameNumber;
+    uint32_t used;     // Queries written
+    std::vector<scopeRecord> scopes;
+  }slotData;
+
+  void Collect(slotData& slot);
+
+  VkDevice device;
+  VkQueryPool pool;
+  double period;         // Nanoseconds per tick
+  uint64_t validMask;
+  uint32_t queriesPerFrame;
+  uint32_t currentSlot;
+  std::vector<slotData> slots;
+  std::vector<uint32_t> openScopes;
+  std::vector<uint64_t> results;
+  gpuFrameTiming latest;
+  std::deque<gpuFrameTiming> history;
+  size_t historyLength = 240;
+};
@@ -1,10 +1,179 @@
 #include "MeshData.h"
+#include <unordered_map>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
 namespace pass
 {
   extern VulkanInterface* interface;
 }
-void Mesh::Draw() 
+
+MeshGeometry::MeshGeometry(VertexStreams&& s, std::vector<uint32_t>&& i)
+  : streams(std::move(s)), indices(std::move(i))
+{
+}
+
+MeshGeometry::MeshGeometry(vertexStreamView s, std::span<const uint32_t> i, std::function<void(void)> r)
+  : adopted(true), release(std::move(r)), adoptedStreams(s), adoptedIndices(i)
+{
+  if (s.colors.size() != s.size() || s.normals.size() != s.size())
+    throw std::runtime_error("vertex streams differ in length!");
+}
+
+MeshGeometry::MeshGeometry(MeshGeometry const& other)
+{
+  vertexStreamView view = other.Streams();
+  streams.positions.assign(view.positions.begin(), view.positions.end());
+  streams.colors.assign(view.colors.begin(), view.colors.end());
+  streams.normals.assign(view.normals.begin(), view.normals.end());
+  std::span<const uint32_t> otherIndices = other.Indices();
+  indices.assign(otherIndices.begin(), otherIndices.end());
+}
+
+MeshGeometry::~MeshGeometry(void)
+{
+  ReleaseGPUBuffer();
+  if (release)
+    release();
+}
+
+VertexStreams& MeshGeometry::EditStreams(void)
+{
+  ReleaseGPUBuffer();
+  return streams;
+}
+
+std::vector<uint32_t>& MeshGeometry::EditIndices(void)
+{
+  ReleaseGPUBuffer();
+  return indices;
+}
+
+void MeshGeometry::Upload(void)
+{
+  std::lock_guard<std::mutex> guard(uploadLock);
+  if (gpuBuffer.buffer || VertexCount() == 0)
+    return;
+  vertexStreamView view = Streams();
+  std::vector<char> packed(VertexStreams::GpuSize(view.size()));
+  VertexStreams::Pack(view, packed.data());
+  gpuBuffer = pass::interface->CreateStaticBuffer(packed.data(), packed.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+  if (IsIndexed())
+  {
+    VkIndexType type = VulkanInterface::SelectIndexType(view.size());
+    std::vector<char> packedIndices(VulkanInterface::IndexSize(type) * Indices().size());
+    VulkanInterface::WriteIndices(packedIndices.data(), Indices(), type);
+    gpuIndexBuffer = pass::interface->CreateStaticBuffer(packedIndices.data(), packedIndices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+  }
+}
+
+void MeshGeometry::ReleaseGPUBuffer(void)
+{
+  if (gpuBuffer.buffer)
+    pass::interface->ReleaseStaticBuffer(gpuBuffer);
+  if (gpuIndexBuffer.buffer)
+    pass::interface->ReleaseStaticBuffer(gpuIndexBuffer);
+  gpuBuffer = {};
+  gpuIndexBuffer = {};
+}
+
+std::shared_ptr<MeshGeometry> const& Mesh::EmptyGeometry()
+{
+  static std::shared_ptr<MeshGeometry> const empty = std::make_shared<MeshGeometry>();
+  return empty;
+}
+
+MeshGeometry& Mesh::Edit()
+{
+  if (geometry.use_count() > 1 || geometry->IsAdopted())
+    geometry = std::make_shared<MeshGeometry>(*geometry);
+  return *geometry;
+}
+
+void Mesh::Draw(uint32_t instanceCount) 
 {
   pass::interface->SetTopology(topology);
-  pass::interface->Draw(verticies);
+  if (resident == false)
+  {
+    if (IsIndexed())
+      pass::interface->DrawIndexed(geometry->Streams(), geometry->Indices(), instanceCount);
+    else
+      pass::interface->Draw(geometry->Streams(), instanceCount);
+    return;
+  }
+
+  geometry->Upload();
+  bufferInfo const& gpuBuffer = geometry->GetGPUBuffer();
+  bufferInfo const& gpuIndexBuffer = geometry->GetGPUIndexBuffer();
+  if (gpuBuffer.buffer == VK_NULL_HANDLE)
+    return;
+  vertexBinding streams = VulkanInterface::StreamBinding(gpuBuffer.buffer, geometry->VertexCount());
+  if (gpuIndexBuffer.buffer)
+    pass::interface->DrawIndexedBuffer(streams, gpuIndexBuffer, static_cast<uint32_t>(geometry->Indices().size()), GetIndexType(), instanceCount);
+  else
+    pass::interface->DrawBuffer(streams, static_cast<uint32_t>(geometry->VertexCount()), instanceCount);
+}
+
+void Mesh::CalculateNormals()
+{
+  MeshGeometry& edit = Edit();
+  VertexStreams& streams = edit.EditStreams();
+  if (edit.IsIndexed())
+    ComputeSmoothNormals(streams.positions, edit.Indices(), streams.normals);
+  else
+    ComputeFaceNormals(streams.positions, streams.normals);
+}
+
+namespace
+{
+  // Vertex is tightly packed floats, so bitwise hashing and comparison are exact
+  struct VertexBitHash
+  {
+    size_t operator()(Vertex const& v) const
+    {
+      // FNV-1a
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&v);
+      uint64_t hash = 14695981039346656037ull;
+      for (size_t i = 0; i < sizeof(Vertex); ++i)
+      {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+      }
+      return static_cast<size_t>(hash);
+    }
+  };
+
+  struct VertexBitEqual
+  {
+    bool operator()(Vertex const& a, Vertex const& b) const
+    {
+      return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+  };
+}
+
+void Mesh::Weld()
+{
+  vertexStreamView streams = geometry->Streams();
+  std::span<const uint32_t> indices = geometry->Indices();
+  const size_t count = IsIndexed() ? indices.size() : streams.size();
+
+  std::unordered_map<Vertex, uint32_t, VertexBitHash, VertexBitEqual> lookup;
+  lookup.reserve(streams.size());
+  VertexStreams unique;
+  unique.reserve(streams.size());
+  std::vector<uint32_t> remapped;
+  remapped.reserve(count);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    Vertex vert = streams.Get(IsIndexed() ? indices[i] : i);
+    auto found = lookup.emplace(vert, static_cast<uint32_t>(unique.size()));
+    if (found.second)
+      unique.push_back(vert);
+    remapped.push_back(found.first->second);
+  }
+
+  // A new block, whatever shared the old one keeps it as it was
+  geometry = std::make_shared<MeshGeometry>(std::move(unique), std::move(remapped));
 }
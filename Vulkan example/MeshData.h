@@ -1,69 +1,172 @@
 #pragma once
 #include "Vertex.h"
+#include "GeometryProcessing.h"
 #include "Vulkan Interface.h"
 #include <vector>
-class Mesh 
+#include <span>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+/*
+ * Vertices and indices shared by every Mesh copied from the same source.
+ * A block is never changed while meshes share it, editing a mesh first gives
+ * it a block of its own. The data is either owned, or caller memory adopted
+ * without a copy and handed back through release once the last mesh lets go.
+ * The GPU copy used by resident meshes lives here too, so meshes sharing a
+ * block share its buffers as well.
+ */
+class MeshGeometry
+{
+public:
+  MeshGeometry(void) = default;
+  MeshGeometry(VertexStreams&& streams, std::vector<uint32_t>&& indices);
+  // Every stream must hold the same number of entries. release may be empty for memory that outlives every mesh
+  MeshGeometry(vertexStreamView streams, std::span<const uint32_t> indices, std::function<void(void)> release);
+  // Owned copy of other's data, without its GPU buffers
+  MeshGeometry(MeshGeometry const& other);
+  MeshGeometry& operator=(MeshGeometry const&) = delete;
+  ~MeshGeometry(void);
+
+  vertexStreamView Streams(void) const { return IsAdopted() ? adoptedStreams : streams.View(); }
+  std::span<const uint32_t> Indices(void) const { return IsAdopted() ? adoptedIndices : std::span<const uint32_t>(indices); }
+  size_t VertexCount(void) const { return Streams().size(); }
+  bool IsIndexed(void) const { return Indices().empty() == false; }
+  bool IsAdopted(void) const { return adopted; }
+
+  // Owned data for editing, drops the GPU copy. Only for blocks no other mesh shares and that aren't adopted
+  VertexStreams& EditStreams(void);
+  std::vector<uint32_t>& EditIndices(void);
+
+  // Uploads the GPU copy unless it's already there. Safe to call from meshes sharing the block on different threads
+  void Upload(void);
+  bufferInfo const& GetGPUBuffer(void) const { return gpuBuffer; }
+  bufferInfo const& GetGPUIndexBuffer(void) const { return gpuIndexBuffer; }
+
+private:
+  void ReleaseGPUBuffer(void);
+
+  VertexStreams streams;
+  std::vector<uint32_t> indices;
+  // Adopted memory, the views point into it instead of the vectors above. release is optional
+  bool adopted = false;
+  std::function<void(void)> release;
+  vertexStreamView adoptedStreams{};
+  std::span<const uint32_t> adoptedIndices;
+  bufferInfo gpuBuffer{};
+  bufferInfo gpuIndexBuffer{};
+  // The only change made to a shared block, guards the GPU copy while it's created
+  std::mutex uploadLock;
+};
+
+class Mesh
 {
 public:
   // Default
   Mesh()
   {
     topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    verticies.reserve(3);
+    geometry = EmptyGeometry();
   };
   // Size Reservation
-  Mesh(int count) 
+  Mesh(int count)
   {
     topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    verticies.reserve(count);
+    geometry = std::make_shared<MeshGeometry>();
+    geometry->EditStreams().reserve(count);
   }
   // Pass Verticies
-  Mesh(std::vector<Vertex> const& v) 
+  Mesh(std::vector<Vertex> const& v)
   {
     topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    verticies = std::vector<Vertex>(v);
-    
+    geometry = std::make_shared<MeshGeometry>(VertexStreams(v), std::vector<uint32_t>());
+
     CalculateNormals();
   }
-  // Copy
-  Mesh(Mesh const& other) 
+  // Takes the streams over without copying, their normals are used as they are
+  Mesh(VertexStreams&& streams, std::vector<uint32_t>&& indices = {})
   {
     topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    verticies = std::vector<Vertex>(other.verticies);
-
-    CalculateNormals();
+    geometry = std::make_shared<MeshGeometry>(std::move(streams), std::move(indices));
   }
-  void CalculateNormals() 
+  /*
+   * Adopts caller memory without copying. The memory must stay valid and
+   * unchanged until release is called, which happens once no mesh uses it.
+   * Static data can pass no release at all.
+   */
+  Mesh(vertexStreamView streams, std::span<const uint32_t> indices, std::function<void(void)> release)
   {
-    for (size_t i = 0; i < verticies.size() - 2; i += 3)
-    {
-      Vertex& in1 = verticies[i];
-      Vertex& in2 = verticies[i + 1];
-      Vertex& in3 = verticies[i + 2];
-
-      glm::vec3 pToq = in2.pos - in1.pos;
-      glm::vec3 pTor = in3.pos - in1.pos;
-
-      in1.normal = glm::vec4(glm::cross(pToq, pTor), 0);
-      in2.normal = in1.normal;
-      in3.normal = in1.normal;
-    }
+    topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    geometry = std::make_shared<MeshGeometry>(streams, indices, std::move(release));
   }
-  // Destructor
-  ~Mesh() 
+  // Copy, shares the geometry (and its GPU buffers) until either mesh is edited
+  Mesh(Mesh const& other) = default;
+  Mesh& operator=(Mesh const& other) = default;
+  // Move, the source is left empty
+  Mesh(Mesh&& other) noexcept
   {
-    verticies.clear();
+    topology = other.topology;
+    geometry = std::exchange(other.geometry, EmptyGeometry());
+    resident = other.resident;
+  }
+  Mesh& operator=(Mesh&& other) noexcept
+  {
+    if (this != &other)
+    {
+      topology = other.topology;
+      geometry = std::exchange(other.geometry, EmptyGeometry());
+      resident = other.resident;
+    }
+    return *this;
   }
+  // Faceted normals for triangle soups, area weighted smooth normals for indexed meshes
+  void CalculateNormals();
+  // Worked out on every call, callers keep the result
+  meshBounds CalculateBounds() const { return ComputeBounds(geometry->Streams().positions); }
+  // Destructor, the geometry goes away with the last mesh sharing it
+  ~Mesh() = default;
 
 
-  void AddVertex(Vertex const& vert) 
+  void AddVertex(Vertex const& vert)
   {
-    verticies.push_back(vert);
+    Edit().EditStreams().push_back(vert);
   }
   void SetTopology(VkPrimitiveTopology t) { topology = t; };
-  void Draw();
+
+  void SetIndices(std::vector<uint32_t> const& i)
+  {
+    Edit().EditIndices() = i;
+  }
+  bool IsIndexed() const { return geometry->IsIndexed(); }
+  // 16 bit indices whenever every vertex can be addressed by one
+  VkIndexType GetIndexType() const { return VulkanInterface::SelectIndexType(geometry->VertexCount()); }
+  bool SharesGeometry(Mesh const& other) const { return geometry == other.geometry; }
+
+  /*
+   * Merges bit identical vertices and rewrites the mesh as indexed geometry.
+   * Call after normals are final, vertices with different normals stay separate.
+   */
+  void Weld();
+
+  /*
+   * Keeps the geometry in a device local buffer shared with every mesh using the same geometry.
+   * It is uploaded once and only uploaded again after the mesh is modified.
+   */
+  void MakeResident() { resident = true; }
+  bool IsResident() const { return resident; }
+
+  // Draws instanceCount copies, instance data must already be bound by the caller
+  void Draw(uint32_t instanceCount = 1);
 private:
+  // Geometry this mesh alone owns, copied first if it is shared or adopted
+  MeshGeometry& Edit();
+  // One empty block every empty mesh points at
+  static std::shared_ptr<MeshGeometry> const& EmptyGeometry();
+
   VkPrimitiveTopology topology;
-  std::vector<Vertex> verticies;
+  // Shared with every copy of this mesh until one of them is edited
+  std::shared_ptr<MeshGeometry> geometry;
+  bool resident = false;
 
-};
\ No newline at end of file
+};
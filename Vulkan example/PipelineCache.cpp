@@ -0,0 +1,132 @@
+#include "PipelineCache.h"
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+constexpr uint32_t CacheMagic = 0x43504B56; // "VKPC"
+constexpr uint32_t CacheVersion = 1;
+
+PipelineCache::PipelineCache(void)
+{
+  device = VK_NULL_HANDLE;
+  cache = VK_NULL_HANDLE;
+  properties = {};
+  loaded = false;
+  savedHash = 0;
+}
+
+void PipelineCache::Create(VkDevice dev, VkPhysicalDevice physical, std::string const& file)
+{
+  device = dev;
+  path = file;
+  vkGetPhysicalDeviceProperties(physical, &properties);
+
+  std::vector<char> data = Load();
+  loaded = data.empty() == false;
+  savedHash = loaded ? Hash(data.data(), data.size()) : 0;
+
+  VkPipelineCacheCreateInfo cacheCreate{};
+  cacheCreate.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cacheCreate.initialDataSize = data.size();
+  cacheCreate.pInitialData = data.empty() ? nullptr : data.data();
+  if (vkCreatePipelineCache(device, &cacheCreate, nullptr, &cache) != VK_SUCCESS)
+  {
+    // The driver can still refuse data that passed our checks, start over empty
+    cacheCreate.initialDataSize = 0;
+    cacheCreate.pInitialData = nullptr;
+    loaded = false;
+    if (vkCreatePipelineCache(device, &cacheCreate, nullptr, &cache) != VK_SUCCESS)
+      throw std::runtime_error("failed to create pipeline cache!");
+  }
+}
+
+void PipelineCache::Destroy(void)
+{
+  if (cache == VK_NULL_HANDLE)
+    return;
+  Save();
+  vkDestroyPipelineCache(device, cache, nullptr);
+  cache = VK_NULL_HANDLE;
+}
+
+std::vector<char> PipelineCache::Load(void)
+{
+  std::ifstream read(path, std::ios_base::binary);
+  if (read.is_open() == false)
+    return {};
+
+  fileHeader header{};
+  read.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (read.gcount() != sizeof(header) || Matches(header) == false)
+    return {};
+
+  std::vector<char> data(static_cast<size_t>(header.dataSize));
+  read.read(data.data(), data.size());
+  if (static_cast<size_t>(read.gcount()) != data.size() || Hash(data.data(), data.size()) != header.dataHash)
+    return {};
+  return data;
+}
+
+bool PipelineCache::Matches(fileHeader const& header) const
+{
+  return header.magic == CacheMagic
+    && header.version == CacheVersion
+    && header.vendorID == properties.vendorID
+    && header.deviceID == properties.deviceID
+    && header.driverVersion == properties.driverVersion
+    && memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::Save(void)
+{
+  if (cache == VK_NULL_HANDLE)
+    return;
+
+  size_t size = 0;
+  vkGetPipelineCacheData(device, cache, &size, nullptr);
+  std::vector<char> data(size);
+  if (size == 0 || vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS)
+    return;
+
+  uint64_t hash = Hash(data.data(), size);
+  if (hash == savedHash)
+    return;
+
+  fileHeader header{};
+  header.magic = CacheMagic;
+  header.version = CacheVersion;
+  header.vendorID = properties.vendorID;
+  header.deviceID = properties.deviceID;
+  header.driverVersion = properties.driverVersion;
+  memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+  header.dataSize = size;
+  header.dataHash = hash;
+
+  std::string temporary = path + ".tmp";
+  {
+    std::ofstream write(temporary, std::ios_base::binary | std::ios_base::trunc);
+    if (write.is_open() == false)
+      return;
+    write.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    write.write(data.data(), size);
+    if (!write)
+      return;
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  if (!error)
+    savedHash = hash;
+}
+
+uint64_t PipelineCache::Hash(char const* data, size_t size)
+{
+  // FNV-1a, only has to catch truncated or damaged files
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
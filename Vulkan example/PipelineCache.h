@@ -0,0 +1,53 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+ * A VkPipelineCache that is loaded from disk when created and written back
+ * on Save. The file starts with our own header naming the device, vendor and
+ * driver that produced it, any mismatch (or a damaged file) starts an empty
+ * cache instead of handing the driver data it can't use.
+ */
+class PipelineCache
+{
+public:
+  PipelineCache(void);
+
+  void Create(VkDevice device, VkPhysicalDevice physical, std::string const& path);
+  // Saves, then destroys the cache
+  void Destroy(void);
+
+  // Writes the cache out if it holds anything the file doesn't yet. The file is
+  // replaced in one rename so a crash mid write never leaves a torn cache behind
+  void Save(void);
+
+  VkPipelineCache Get(void) const { return cache; }
+  // True if the data on disk was accepted
+  bool WasLoaded(void) const { return loaded; }
+
+private:
+  typedef struct fileHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t dataHash;
+  }fileHeader;
+
+  std::vector<char> Load(void);
+  bool Matches(fileHeader const& header) const;
+  static uint64_t Hash(char const* data, size_t size);
+
+  VkDevice device;
+  VkPipelineCache cache;
+  VkPhysicalDeviceProperties properties;
+  std::string path;
+  bool loaded;
+  uint64_t savedHash;
+};
@@ -0,0 +1,47 @@
+#include "RadixSort.h"
+#include <array>
+
+void RadixSort(std::vector<sortEntry>& entries, std::vector<sortEntry>& scratch)
+{
+  const size_t count = entries.size();
+  if (count < 2)
+    return;
+  scratch.resize(count);
+
+  // Every histogram in one read over the keys
+  std::array<std::array<uint32_t, 256>, 8> histograms{};
+  for (sortEntry const& entry : entries)
+  {
+    for (int pass = 0; pass < 8; ++pass)
+      ++histograms[pass][(entry.key >> (pass * 8)) & 0xFF];
+  }
+
+  sortEntry* source = entries.data();
+  sortEntry* destination = scratch.data();
+  for (int pass = 0; pass < 8; ++pass)
+  {
+    std::array<uint32_t, 256>& histogram = histograms[pass];
+    const int shift = pass * 8;
+    if (histogram[(source[0].key >> shift) & 0xFF] == count)
+      continue;
+
+    // Histogram becomes the starting offset of each bucket
+    uint32_t offset = 0;
+    for (uint32_t& bucket : histogram)
+    {
+      uint32_t size = bucket;
+      bucket = offset;
+      offset += size;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+      destination[histogram[(source[i].key >> shift) & 0xFF]++] = source[i];
+
+    sortEntry* swap = source;
+    source = destination;
+    destination = swap;
+  }
+
+  if (source != entries.data())
+    entries.swap(scratch);
+}
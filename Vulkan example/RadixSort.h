@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// A sort key and the index of the item it was built for
+typedef struct sortEntry
+{
+  uint64_t key;
+  uint32_t index;
+}sortEntry;
+
+/*
+ * Stable LSD radix sort on the 64 bit keys, one byte per pass.
+ * Passes where every key has the same byte are skipped, so keys that only
+ * use a few of their bits cost only a few passes.
+ * scratch is resized as needed and can be reused between calls.
+ */
+void RadixSort(std::vector<sortEntry>& entries, std::vector<sortEntry>& scratch);
@@ -0,0 +1,88 @@
+#include "RingBuffer.h"
+
+RingBuffer::RingBuffer(void)
+{
+  allocator = 0;
+  memory = 0;
+  buffer = 0;
+  mapped = nullptr;
+  regionSize = 0;
+  regionBase = 0;
+  head = 0;
+  stats = {};
+}
+
+void RingBuffer::Create(VmaAllocator alloc, VkDeviceSize frameSize, uint32_t frameCount, VkBufferUsageFlags usage)
+{
+  allocator = alloc;
+  // Keeps every region base aligned for any index or vertex attribute offset
+  regionSize = (frameSize + 255) / 256 * 256;
+
+  VkBufferCreateInfo bufferCreate{};
+  bufferCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCreate.size = regionSize * frameCount;
+  bufferCreate.usage = usage;
+  bufferCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  // Written once by the CPU and read once by the GPU, so sequential write is the right hint
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO;
+  allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+  allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VmaAllocationInfo AllocInfo;
+  if (vmaCreateBuffer(allocator, &bufferCreate, &allocationInfo, &buffer, &memory, &AllocInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to create transient ring buffer!");
+
+  mapped = static_cast<char*>(AllocInfo.pMappedData);
+  regionBase = 0;
+  head = 0;
+  stats = {};
+  stats.capacity = regionSize;
+}
+
+void RingBuffer::Destroy(void)
+{
+  if (buffer)
+    vmaDestroyBuffer(allocator, buffer, memory);
+  buffer = 0;
+  memory = 0;
+  mapped = nullptr;
+}
+
+void RingBuffer::BeginFrame(uint32_t frame)
+{
+  regionBase = regionSize * frame;
+  head = 0;
+  stats.used = 0;
+}
+
+bool RingBuffer::Allocate(VkDeviceSize size, VkDeviceSize alignment, ringAllocation* out)
+{
+  VkDeviceSize offset = head;
+  if (alignment > 1)
+    offset = (offset + alignment - 1) / alignment * alignment;
+
+  if (offset + size > regionSize)
+  {
+    ++stats.overflowCount;
+    return false;
+  }
+
+  head = offset + size;
+  stats.used = head;
+  if (head > stats.highWater)
+    stats.highWater = head;
+
+  out->buffer = buffer;
+  out->offset = regionBase + offset;
+  out->data = mapped + regionBase + offset;
+  return true;
+}
+
+void RingBuffer::Flush(void)
+{
+  // No-op on coherent memory, VMA checks the memory type for us
+  if (head != 0)
+    vmaFlushAllocation(allocator, memory, regionBase, head);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vma/vk_mem_alloc.h>
+
+// A sub-allocation handed out by the ring, valid until the frame slot is reused
+typedef struct ringAllocation
+{
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  void* data;
+}ringAllocation;
+
+typedef struct ringStats
+{
+  VkDeviceSize capacity;   // Bytes available to each frame
+  VkDeviceSize used;       // Bytes used by the frame currently being recorded
+  VkDeviceSize highWater;  // Most bytes any single frame has used
+  uint64_t overflowCount;  // Allocations that did not fit and had to fall back
+}ringStats;
+
+/*
+ * One persistently mapped buffer split into a region per frame in flight.
+ * Each region is a linear (bump pointer) allocator that is rewound when
+ * its frame slot comes back around, so nothing is freed individually.
+ */
+class RingBuffer
+{
+public:
+  RingBuffer(void);
+
+  void Create(VmaAllocator alloc, VkDeviceSize frameSize, uint32_t frameCount, VkBufferUsageFlags usage);
+  void Destroy(void);
+
+  // Rewinds the region of the given frame slot, the slot's frame must have completed
+  void BeginFrame(uint32_t frame);
+
+  // Returns false when the current frame's region is exhausted
+  bool Allocate(VkDeviceSize size, VkDeviceSize alignment, ringAllocation* out);
+
+  // Makes the current frame's writes visible to the device on non-coherent memory
+  void Flush(void);
+
+  ringStats GetStats(void) const { return stats; }
+  VkBuffer GetBuffer(void) const { return buffer; }
+  // Offset of the current frame's region inside the buffer
+  VkDeviceSize GetRegionBase(void) const { return regionBase; }
+
+private:
+  VmaAllocator allocator;
+  VmaAllocation memory;
+  VkBuffer buffer;
+  char* mapped;
+  VkDeviceSize regionSize;
+  VkDeviceSize regionBase;
+  VkDeviceSize head;
+  ringStats stats;
+};
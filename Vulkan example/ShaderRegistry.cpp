@@ -0,0 +1,242 @@
+#include "ShaderRegistry.h"
+#include "EmbeddedShaders.h"
+#include <fstream>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+constexpr uint32_t PackMagic = 0x4B505053; // "SPPK"
+constexpr uint32_t PackVersion = 1;
+
+static std::string FileName(std::string const& path)
+{
+  size_t slash = path.find_last_of("/\\");
+  return (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+ShaderRegistry::ShaderRegistry(void)
+{
+  device = VK_NULL_HANDLE;
+  packData = nullptr;
+  packSize = 0;
+  fileHandle = nullptr;
+  mappingHandle = nullptr;
+}
+
+void ShaderRegistry::Create(VkDevice dev)
+{
+  device = dev;
+}
+
+void ShaderRegistry::Destroy(void)
+{
+  for (auto& module : modules)
+    vkDestroyShaderModule(device, module.second.module, nullptr);
+  modules.clear();
+  byPath.clear();
+  loadedCode.clear();
+  Unmap();
+}
+
+void ShaderRegistry::Unmap(void)
+{
+  if (packData == nullptr)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(packData);
+  CloseHandle(static_cast<HANDLE>(mappingHandle));
+  CloseHandle(static_cast<HANDLE>(fileHandle));
+#else
+  munmap(const_cast<void*>(packData), packSize);
+#endif
+  packData = nullptr;
+  packSize = 0;
+  fileHandle = nullptr;
+  mappingHandle = nullptr;
+}
+
+bool ShaderRegistry::MapPack(std::string const& path)
+{
+  if (packData)
+    return false;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size{};
+  GetFileSizeEx(file, &size);
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  void const* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (view == nullptr)
+  {
+    if (mapping)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  packData = view;
+  packSize = static_cast<size_t>(size.QuadPart);
+  fileHandle = file;
+  mappingHandle = mapping;
+#else
+  int file = open(path.c_str(), O_RDONLY);
+  if (file < 0)
+    return false;
+  struct stat info {};
+  fstat(file, &info);
+  void* view = (info.st_size > 0) ? mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+  // The mapping keeps the file alive on its own
+  close(file);
+  if (view == MAP_FAILED)
+    return false;
+  packData = view;
+  packSize = static_cast<size_t>(info.st_size);
+#endif
+
+  // Reject anything that would let an entry point outside of the mapping
+  packHeader const* header = static_cast<packHeader const*>(packData);
+  bool valid = packSize >= sizeof(packHeader)
+    && header->magic == PackMagic
+    && header->version == PackVersion
+    && sizeof(packHeader) + sizeof(packEntry) * uint64_t(header->count) <= packSize;
+  packEntry const* entries = reinterpret_cast<packEntry const*>(header + 1);
+  for (uint32_t i = 0; valid && i < header->count; ++i)
+  {
+    valid = entries[i].offset % 4 == 0 && entries[i].size % 4 == 0
+      && uint64_t(entries[i].offset) + entries[i].size <= packSize
+      && memchr(entries[i].name, 0, sizeof(entries[i].name)) != nullptr;
+  }
+  if (valid == false)
+    Unmap();
+  return valid;
+}
+
+bool ShaderRegistry::WritePack(std::string const& path, std::vector<std::string> const& files)
+{
+  std::vector<packEntry> entries(files.size());
+  std::vector<std::vector<char>> blobs(files.size());
+  uint32_t offset = static_cast<uint32_t>(sizeof(packHeader) + sizeof(packEntry) * files.size());
+  for (size_t i = 0; i < files.size(); ++i)
+  {
+    std::ifstream read(files[i], std::ios_base::binary | std::ios_base::ate);
+    std::string name = FileName(files[i]);
+    if (read.is_open() == false || name.size() >= sizeof(entries[i].name))
+      return false;
+    blobs[i].resize(static_cast<size_t>(read.tellg()));
+    read.seekg(0);
+    read.read(blobs[i].data(), blobs[i].size());
+    if (blobs[i].size() % 4 != 0)
+      return false;
+
+    memset(entries[i].name, 0, sizeof(entries[i].name));
+    memcpy(entries[i].name, name.data(), name.size());
+    entries[i].offset = offset;
+    entries[i].size = static_cast<uint32_t>(blobs[i].size());
+    offset += entries[i].size;
+  }
+
+  packHeader header{ PackMagic, PackVersion, static_cast<uint32_t>(files.size()), 0 };
+  std::ofstream write(path, std::ios_base::binary | std::ios_base::trunc);
+  write.write(reinterpret_cast<char const*>(&header), sizeof(header));
+  write.write(reinterpret_cast<char const*>(entries.data()), sizeof(packEntry) * entries.size());
+  for (std::vector<char> const& blob : blobs)
+    write.write(blob.data(), blob.size());
+  return static_cast<bool>(write);
+}
+
+std::span<const uint32_t> ShaderRegistry::FindCode(std::string const& name) const
+{
+  for (embeddedShader const* shader = embeddedShaders; shader->name; ++shader)
+  {
+    if (name == shader->name)
+      return { shader->code, shader->size / sizeof(uint32_t) };
+  }
+
+  if (packData)
+  {
+    packHeader const* header = static_cast<packHeader const*>(packData);
+    packEntry const* entries = reinterpret_cast<packEntry const*>(header + 1);
+    for (uint32_t i = 0; i < header->count; ++i)
+    {
+      if (name == entries[i].name)
+      {
+        char const* base = static_cast<char const*>(packData);
+        return { reinterpret_cast<uint32_t const*>(base + entries[i].offset), entries[i].size / sizeof(uint32_t) };
+      }
+    }
+  }
+  return {};
+}
+
+VkShaderModule ShaderRegistry::Get(std::string const& path)
+{
+  auto known = byPath.find(path);
+  if (known != byPath.end())
+    return known->second;
+
+  VkShaderModule module = VK_NULL_HANDLE;
+  std::span<const uint32_t> code = FindCode(FileName(path));
+  if (code.empty() == false)
+  {
+    module = CreateModule(code);
+  }
+  else
+  {
+    // Neither embedded nor packed, this is the only case that reads a file
+    std::ifstream read(path, std::ios_base::binary | std::ios_base::ate);
+    if (read.is_open() == false)
+      throw std::runtime_error("Failed to open shader file");
+    std::vector<uint32_t> words((static_cast<size_t>(read.tellg()) + 3) / 4);
+    read.seekg(0);
+    read.read(reinterpret_cast<char*>(words.data()), words.size() * sizeof(uint32_t));
+    loadedCode.push_back(std::move(words));
+    module = CreateModule(loadedCode.back());
+  }
+  byPath[path] = module;
+  return module;
+}
+
+VkShaderModule ShaderRegistry::CreateModule(std::span<const uint32_t> code)
+{
+  uint64_t hash = Hash(code);
+  auto range = modules.equal_range(hash);
+  for (auto existing = range.first; existing != range.second; ++existing)
+  {
+    // The hash only narrows it down, different code may collide
+    std::span<const uint32_t> known = existing->second.code;
+    if (known.size() == code.size() && memcmp(known.data(), code.data(), code.size_bytes()) == 0)
+      return existing->second.module;
+  }
+
+  VkShaderModuleCreateInfo shaderCreate{};
+  shaderCreate.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  shaderCreate.codeSize = code.size_bytes();
+  shaderCreate.pCode = code.data();
+  VkShaderModule module = VK_NULL_HANDLE;
+  if (vkCreateShaderModule(device, &shaderCreate, nullptr, &module) != VK_SUCCESS)
+    throw std::runtime_error("failed to create shader module!");
+  modules.emplace(hash, shaderModule{ code, module });
+  return module;
+}
+
+uint64_t ShaderRegistry::Hash(std::span<const uint32_t> code)
+{
+  // FNV-1a over whole words, mixed with the length
+  uint64_t hash = 14695981039346656037ull ^ code.size();
+  for (uint32_t word : code)
+  {
+    hash ^= word;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <string>
+#include <span>
+#include <vector>
+#include <unordered_map>
+
+/*
+ * Owns every shader module. Shaders are looked up by file name and come from,
+ * in order:
+ *  - SPIR-V compiled into the binary (EmbeddedShaders.h)
+ *  - a shader pack mapped into memory
+ *  - the file on disk, only as a fallback for shaders that are in neither
+ * Embedded and packed code goes straight to vkCreateShaderModule without being
+ * copied. Modules are keyed by a hash of their code and matched byte for byte,
+ * so identical shaders under different names share one module. Modules live
+ * until Destroy.
+ *
+ * Shader pack layout, all little endian and 4 byte aligned:
+ *   packHeader, packEntry[count], SPIR-V blobs at the entries' offsets
+ */
+class ShaderRegistry
+{
+public:
+  ShaderRegistry(void);
+
+  void Create(VkDevice device);
+  // Destroys every module and unmaps the pack
+  void Destroy(void);
+
+  // Maps a pack built with WritePack, returns false if it can't be used.
+  // Only one pack can be mapped, it stays mapped until Destroy
+  bool MapPack(std::string const& path);
+  // Writes the given .spv files into a pack, stored under their file names.
+  // Run by the post-build step through the application's --pack-shaders mode
+  static bool WritePack(std::string const& path, std::vector<std::string> const& files);
+
+  VkShaderModule Get(std::string const& path);
+
+  typedef struct packHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+  }packHeader;
+
+  typedef struct packEntry
+  {
+    char name[48];
+    uint32_t offset;   // From the start of the pack
+    uint32_t size;     // Bytes
+  }packEntry;
+
+private:
+  void Unmap(void);
+  std::span<const uint32_t> FindCode(std::string const& name) const;
+  VkShaderModule CreateModule(std::span<const uint32_t> code);
+  static uint64_t Hash(std::span<const uint32_t> code);
+
+  typedef struct shaderModule
+  {
+    std::span<const uint32_t> code;   // Embedded, packed or held by loadedCode
+    VkShaderModule module;
+  }shaderModule;
+
+  VkDevice device;
+  // Modules per code hash, more than one only if hashes collide, and per requested path
+  std::unordered_multimap<uint64_t, shaderModule> modules;
+  std::unordered_map<std::string, VkShaderModule> byPath;
+  // Code read from disk, kept for comparing against later shaders
+  std::vector<std::vector<uint32_t>> loadedCode;
+
+  // Mapped shader pack
+  void const* packData;
+  size_t packSize;
+  void* fileHandle;
+  void* mappingHandle;
+};
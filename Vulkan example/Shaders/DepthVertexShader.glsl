@@ -0,0 +1,38 @@
+#version 450
+layout(location = 0) in vec3 inPosition;
+
+
+// Camera and light, written once per frame
+layout(std140, set = 0, binding = 1) uniform frameBuffer
+{
+  mat4x4 worldProjection;
+  mat4x4 viewProjection;
+  mat4x4 combinedProjection;
+  vec4 lightPos;
+  float lightStrenght;
+  float light_factor;
+  float ambient_factor;
+  float pad;
+};
+
+struct objectTransform
+{
+  mat4x4 model;
+  mat3x3 normal;
+};
+
+// Same object buffer as the indirect shader, the pre-pass draws the same queue
+layout(std430, set = 0, binding = 0) readonly buffer objectBuffer
+{
+  objectTransform objects[];
+};
+
+// The color pass tests against this depth with EQUAL, both shaders must agree exactly
+invariant gl_Position;
+
+void main() {
+
+    vec4 worldPosition =  objects[gl_InstanceIndex].model * vec4(inPosition, 1.0); 
+    vec4 pos =  combinedProjection * worldPosition;
+    gl_Position = pos;
+}
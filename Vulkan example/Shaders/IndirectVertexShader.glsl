@@ -0,0 +1,56 @@
+#version 450
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 octNormal;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 4) out vec4 worldPosition;
+layout(location = 8) out vec4 modNormal;
+
+
+// Camera and light, written once per frame
+layout(std140, set = 0, binding = 1) uniform frameBuffer
+{
+  mat4x4 worldProjection;
+  mat4x4 viewProjection;
+  mat4x4 combinedProjection;
+  vec4 lightPos;
+  float lightStrenght;
+  float light_factor;
+  float ambient_factor;
+  float pad;
+};
+
+struct objectTransform
+{
+  mat4x4 model;
+  mat3x3 normal;
+};
+
+// One transform per object, firstInstance of each indirect command points at its first
+layout(std430, set = 0, binding = 0) readonly buffer objectBuffer
+{
+  objectTransform objects[];
+};
+
+// Matches the depth pre-pass shader exactly, the color pass tests with EQUAL
+invariant gl_Position;
+
+// Normals come in octahedral encoded, two snorm components
+vec3 OctDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
+void main() {
+
+    objectTransform object = objects[gl_InstanceIndex];
+    modNormal = vec4(normalize(object.normal * OctDecode(octNormal)), 0.0);
+    worldPosition =  object.model * vec4(inPosition, 1.0); 
+    vec4 pos =  combinedProjection * worldPosition;
+    gl_Position = pos;
+    fragColor = inColor;
+}
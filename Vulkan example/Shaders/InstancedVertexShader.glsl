@@ -0,0 +1,43 @@
+#version 450
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec4 inColor;
+layout(location = 2) in vec2 octNormal;
+// Per instance model matrix, takes locations 3 - 6, and its normal matrix at 7 - 9
+layout(location = 3) in mat4 instanceModel;
+layout(location = 7) in mat3 instanceNormal;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 4) out vec4 worldPosition;
+layout(location = 8) out vec4 modNormal;
+
+
+// Camera and light, written once per frame
+layout(std140, set = 0, binding = 1) uniform frameBuffer
+{
+  mat4x4 worldProjection;
+  mat4x4 viewProjection;
+  mat4x4 combinedProjection;
+  vec4 lightPos;
+  float lightStrenght;
+  float light_factor;
+  float ambient_factor;
+  float pad;
+};
+
+// Normals come in octahedral encoded, two snorm components
+vec3 OctDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
+void main() {
+
+    modNormal = vec4(normalize(instanceNormal * OctDecode(octNormal)), 0.0);
+    worldPosition =  instanceModel * vec4(inPosition, 1.0); 
+    vec4 pos =  combinedProjection * worldPosition;
+    gl_Position = pos;
+    fragColor = inColor;
+}
@@ -6,16 +6,17 @@ layout(location = 8) in vec4 modNormal;
 
 layout(location = 0) out vec4 outColors;
 
-layout(push_constant) uniform lightInfo
+// Camera and light, written once per frame
+layout(std140, set = 0, binding = 1) uniform frameBuffer
 {
   mat4x4 worldProjection;
   mat4x4 viewProjection;
-  mat4x4 objectPosition;
+  mat4x4 combinedProjection;
   vec4 lightPos;
   float lightStrenght;
   float light_factor;
   float ambient_factor;
-  float[1] pad;
+  float pad;
 };
 
 
@@ -1,29 +1,47 @@
 #version 450
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec4 inColor;
-layout(location = 2) in vec4 normal;
+layout(location = 2) in vec2 octNormal;
 
 layout(location = 0) out vec4 fragColor;
 layout(location = 4) out vec4 worldPosition;
 layout(location = 8) out vec4 modNormal;
 
 
-layout(push_constant) uniform worldBuffer
+// Camera and light, written once per frame
+layout(std140, set = 0, binding = 1) uniform frameBuffer
 {
   mat4x4 worldProjection;
   mat4x4 viewProjection;
-  mat4x4 objectPosition;
+  mat4x4 combinedProjection;
   vec4 lightPos;
   float lightStrenght;
-  float[3] pad;
+  float light_factor;
+  float ambient_factor;
+  float pad;
 };
 
+// The only thing pushed per draw, the normal matrix is worked out on the CPU
+layout(push_constant) uniform drawBuffer
+{
+  mat4x4 objectPosition;
+  mat3x3 normalMatrix;
+};
+
+// Normals come in octahedral encoded, two snorm components
+vec3 OctDecode(vec2 e)
+{
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
 void main() {
 
-    mat4 tpInverse = mat4(transpose(mat3(inverse(objectPosition))));
-    modNormal = normalize(tpInverse * normal);
+    modNormal = vec4(normalize(normalMatrix * OctDecode(octNormal)), 0.0);
     worldPosition =  objectPosition * vec4(inPosition, 1.0); 
-    vec4 pos =  worldProjection * viewProjection * worldPosition;
+    vec4 pos =  combinedProjection * worldPosition;
     gl_Position = pos;
     fragColor = inColor;
 }
\ No newline at end of file
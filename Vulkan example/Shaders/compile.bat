@@ -1,3 +1,10 @@
 C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -fshader-stage=vertex -fentry-point=main VertexShader.glsl -o vert.spv
 C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -fshader-stage=frag -fentry-point=main PixelShader.glsl -o frag.spv
-pause
\ No newline at end of file
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -fshader-stage=vertex -fentry-point=main InstancedVertexShader.glsl -o vert_instanced.spv
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -fshader-stage=vertex -fentry-point=main IndirectVertexShader.glsl -o vert_indirect.spv
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -fshader-stage=vertex -fentry-point=main DepthVertexShader.glsl -o vert_depth.spv
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -mfmt=c -fshader-stage=vertex -fentry-point=main VertexShader.glsl -o vert.inc
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -mfmt=c -fshader-stage=frag -fentry-point=main PixelShader.glsl -o frag.inc
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -mfmt=c -fshader-stage=vertex -fentry-point=main InstancedVertexShader.glsl -o vert_instanced.inc
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -mfmt=c -fshader-stage=vertex -fentry-point=main IndirectVertexShader.glsl -o vert_indirect.inc
+C:/VulkanSDK/1.3.243.0/Bin/glslc.exe  -w  -mfmt=c -fshader-stage=vertex -fentry-point=main DepthVertexShader.glsl -o vert_depth.inc
@@ -0,0 +1,2 @@
+rem Packs the SPIR-V for ShaderRegistry to map, using the application passed by the post-build step
+"%~1" --pack-shaders shaders.pack vert.spv frag.spv vert_instanced.spv vert_indirect.spv vert_depth.spv
@@ -0,0 +1,89 @@
+#include "ThreadPool.h"
+#include <latch>
+
+ThreadPool::~ThreadPool(void)
+{
+  Destroy();
+}
+
+void ThreadPool::Create(uint32_t threadCount)
+{
+  stopping = false;
+  for (uint32_t i = 0; i < threadCount; ++i)
+    workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+void ThreadPool::Destroy(void)
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread& worker : workers)
+    worker.join();
+  workers.clear();
+}
+
+void ThreadPool::Submit(std::function<void(void)> job)
+{
+  // Without workers the job runs on the caller
+  if (workers.empty())
+  {
+    job();
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(std::move(job));
+  }
+  wake.notify_one();
+}
+
+void ThreadPool::Dispatch(uint32_t count, std::function<void(uint32_t)> const& job)
+{
+  if (count == 0)
+    return;
+  std::latch done(count);
+  // The first exception thrown by any job, the others are dropped
+  std::exception_ptr failure;
+  std::mutex failureLock;
+  for (uint32_t i = 0; i < count; ++i)
+  {
+    Submit([&job, &done, &failure, &failureLock, i]()
+      {
+        try
+        {
+          job(i);
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> guard(failureLock);
+          if (failure == nullptr)
+            failure = std::current_exception();
+        }
+        done.count_down();
+      });
+  }
+  done.wait();
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+void ThreadPool::WorkerLoop(void)
+{
+  for (;;)
+  {
+    std::function<void(void)> job;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [this]() { return stopping || !jobs.empty(); });
+      // Drain the queue before leaving so nothing waiting on a job hangs
+      if (jobs.empty())
+        return;
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+
+/*
+ * A fixed set of worker threads pulling jobs off a shared queue.
+ * Jobs must not submit to and then wait on the same pool.
+ */
+class ThreadPool
+{
+public:
+  ThreadPool(void) = default;
+  ~ThreadPool(void);
+
+  void Create(uint32_t threadCount);
+  // Finishes the queued jobs and joins the workers
+  void Destroy(void);
+
+  uint32_t GetThreadCount(void) const { return static_cast<uint32_t>(workers.size()); }
+
+  void Submit(std::function<void(void)> job);
+
+  // Runs job on a worker, its result (or exception) comes back through the future
+  template<typename Job>
+  auto Async(Job job) -> std::future<decltype(job())>
+  {
+    auto task = std::make_shared<std::packaged_task<decltype(job())(void)>>(std::move(job));
+    std::future<decltype(job())> result = task->get_future();
+    Submit([task]() { (*task)(); });
+    return result;
+  }
+
+  // Runs job(0) .. job(count - 1) across the workers and returns once all of them finished.
+  // Every index runs even if some throw, the first exception is then rethrown here
+  void Dispatch(uint32_t count, std::function<void(uint32_t)> const& job);
+
+private:
+  void WorkerLoop(void);
+
+  std::vector<std::thread> workers;
+  std::deque<std::function<void(void)>> jobs;
+  std::mutex lock;
+  std::condition_variable wake;
+  bool stopping = false;
+};
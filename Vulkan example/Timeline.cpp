@@ -0,0 +1,105 @@
+#include "Timeline.h"
+#include <stdexcept>
+
+Timeline::Timeline(void)
+{
+  device = VK_NULL_HANDLE;
+  queue = VK_NULL_HANDLE;
+  semaphore = VK_NULL_HANDLE;
+  submitted = 0;
+  completed = 0;
+}
+
+void Timeline::Create(VkDevice dev, VkQueue submitQueue)
+{
+  device = dev;
+  queue = submitQueue;
+
+  VkSemaphoreTypeCreateInfo typeCreate{};
+  typeCreate.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  typeCreate.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeCreate.initialValue = 0;
+  VkSemaphoreCreateInfo semaCreate{};
+  semaCreate.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaCreate.pNext = &typeCreate;
+  if (vkCreateSemaphore(device, &semaCreate, nullptr, &semaphore) != VK_SUCCESS)
+    throw std::runtime_error("failed to create timeline semaphore!");
+}
+
+void Timeline::Destroy(void)
+{
+  if (semaphore == VK_NULL_HANDLE)
+    return;
+  Wait(Submitted());
+  vkDestroySemaphore(device, semaphore, nullptr);
+  semaphore = VK_NULL_HANDLE;
+}
+
+uint64_t Timeline::Submit(VkCommandBuffer const* buffers, uint32_t bufferCount, timelineWaits const& waits, VkSemaphore binarySignal)
+{
+  std::lock_guard<std::mutex> guard(submitLock);
+  uint64_t value = submitted.load(std::memory_order_relaxed) + 1;
+
+  std::array<VkSemaphore, 2> signals = { semaphore, binarySignal };
+  std::array<uint64_t, 2> signalValues = { value, 0 };
+  VkTimelineSemaphoreSubmitInfo timelineInfo{};
+  timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timelineInfo.waitSemaphoreValueCount = waits.count;
+  timelineInfo.pWaitSemaphoreValues = waits.values.data();
+  timelineInfo.signalSemaphoreValueCount = (binarySignal != VK_NULL_HANDLE) ? 2 : 1;
+  timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+  VkSubmitInfo submitInfo{};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.pNext = &timelineInfo;
+  submitInfo.waitSemaphoreCount = waits.count;
+  submitInfo.pWaitSemaphores = waits.semaphores.data();
+  submitInfo.pWaitDstStageMask = waits.stages.data();
+  submitInfo.commandBufferCount = bufferCount;
+  submitInfo.pCommandBuffers = buffers;
+  submitInfo.signalSemaphoreCount = timelineInfo.signalSemaphoreValueCount;
+  submitInfo.pSignalSemaphores = signals.data();
+  if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+    throw std::runtime_error("failed to submit to queue!");
+
+  submitted.store(value, std::memory_order_release);
+  return value;
+}
+
+VkResult Timeline::Present(VkPresentInfoKHR const& info)
+{
+  std::lock_guard<std::mutex> guard(submitLock);
+  return vkQueuePresentKHR(queue, &info);
+}
+
+uint64_t Timeline::Completed(void)
+{
+  uint64_t value = 0;
+  vkGetSemaphoreCounterValue(device, semaphore, &value);
+  // Keep the highest seen so concurrent pollers never go backwards
+  uint64_t seen = completed.load(std::memory_order_relaxed);
+  while (seen < value && completed.compare_exchange_weak(seen, value, std::memory_order_relaxed) == false);
+  return (seen > value) ? seen : value;
+}
+
+bool Timeline::IsComplete(uint64_t value)
+{
+  if (value <= completed.load(std::memory_order_relaxed))
+    return true;
+  return value <= Completed();
+}
+
+void Timeline::Wait(uint64_t value)
+{
+  if (IsComplete(value))
+    return;
+  VkSemaphoreWaitInfo waitInfo{};
+  waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &semaphore;
+  waitInfo.pValues = &value;
+  if (vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+    throw std::runtime_error("failed to wait on timeline semaphore!");
+  uint64_t seen = completed.load(std::memory_order_relaxed);
+  while (seen < value && completed.compare_exchange_weak(seen, value, std::memory_order_relaxed) == false);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <array>
+#include <atomic>
+#include <mutex>
+
+// Semaphores a submission waits on, binary semaphores may be mixed in (their value is ignored)
+typedef struct timelineWaits
+{
+  static constexpr uint32_t Capacity = 4;
+  std::array<VkSemaphore, Capacity> semaphores;
+  std::array<uint64_t, Capacity> values;
+  std::array<VkPipelineStageFlags, Capacity> stages;
+  uint32_t count = 0;
+
+  void Add(VkSemaphore semaphore, uint64_t value, VkPipelineStageFlags stage)
+  {
+    semaphores[count] = semaphore;
+    values[count] = value;
+    stages[count++] = stage;
+  }
+}timelineWaits;
+
+/*
+ * A timeline semaphore owned by one queue. Every submission through it signals
+ * the next value, so a value stands for everything submitted to the queue up to
+ * and including that submission. The CPU can poll or wait on any value and the
+ * GPU can wait on one from another queue. Submit may be called from any thread,
+ * Completed, IsComplete and Wait as well.
+ */
+class Timeline
+{
+public:
+  Timeline(void);
+
+  void Create(VkDevice device, VkQueue queue);
+  void Destroy(void);
+
+  /*
+   * Submits buffers after waits, returns the value signaled once they are done.
+   * binarySignal (if any) is signaled too, for presenting.
+   */
+  uint64_t Submit(VkCommandBuffer const* buffers, uint32_t bufferCount, timelineWaits const& waits, VkSemaphore binarySignal = VK_NULL_HANDLE);
+  // Presents on the same queue, under the same lock as Submit
+  VkResult Present(VkPresentInfoKHR const& info);
+
+  // Value of the most recent submission
+  uint64_t Submitted(void) const { return submitted.load(std::memory_order_acquire); }
+  // Highest value the GPU reached so far
+  uint64_t Completed(void);
+  bool IsComplete(uint64_t value);
+  // Blocks until the GPU reached value, returns straight away for 0
+  void Wait(uint64_t value);
+
+  VkSemaphore Semaphore(void) const { return semaphore; }
+  bool IsCreated(void) const { return semaphore != VK_NULL_HANDLE; }
+
+private:
+  VkDevice device;
+  VkQueue queue;
+  VkSemaphore semaphore;
+  // Queues need external synchronization, the value is taken under the same lock
+  std::mutex submitLock;
+  std::atomic<uint64_t> submitted;
+  std::atomic<uint64_t> completed;
+};
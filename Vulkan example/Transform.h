@@ -0,0 +1,60 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm\ext\matrix_transform.hpp>
+
+// Model matrix and the matrix its normals are transformed by. The same layout is used
+// for the push constant, the instance stream and the object buffer. The normal matrix
+// columns are padded to vec4, matching a GLSL mat3 in std430 and push constants
+typedef struct objectTransform
+{
+  glm::mat4x4 model;
+  glm::mat3x4 normal;
+}objectTransform;
+
+// Position, rotation (degrees) and scale of a single object
+typedef struct Transform
+{
+  glm::vec3 position = { 0,0,0 };
+  glm::vec3 rotation = { 0,0,0 };
+  glm::vec3 scale = { 1,1,1 };
+
+  glm::mat4x4 GetMatrix() const
+  {
+    glm::vec3 localPos = position;
+    localPos.x *= -1, localPos.y *= -1;
+    glm::mat4x4 matrix = glm::translate(glm::identity<glm::mat4x4>(), localPos) * GetRotation();
+    matrix = glm::scale(matrix, scale);
+    return matrix;
+  }
+
+  /*
+   * GetMatrix plus its normal matrix, the inverse transpose of the upper 3x3.
+   * The rotation is orthonormal, so that is just the rotation with the inverse
+   * scale and no general inverse is needed.
+   */
+  objectTransform GetObjectTransform() const
+  {
+    glm::mat4x4 rotationMatrix = GetRotation();
+    glm::vec3 localPos = position;
+    localPos.x *= -1, localPos.y *= -1;
+    objectTransform result;
+    result.model = glm::scale(glm::translate(glm::identity<glm::mat4x4>(), localPos) * rotationMatrix, scale);
+    glm::mat3 normal = glm::mat3(rotationMatrix);
+    normal[0] /= scale.x;
+    normal[1] /= scale.y;
+    normal[2] /= scale.z;
+    result.normal = glm::mat3x4(normal);
+    return result;
+  }
+
+private:
+  glm::mat4x4 GetRotation() const
+  {
+    glm::vec3 local = glm::radians(rotation);
+    glm::mat4x4 matrix = glm::identity<glm::mat4x4>();
+    matrix = glm::rotate(matrix, local.x, { 0,0,1 });
+    matrix = glm::rotate(matrix, local.y, { 1,0,0 });
+    matrix = glm::rotate(matrix, local.z, { 0,1,0 });
+    return matrix;
+  }
+}Transform;
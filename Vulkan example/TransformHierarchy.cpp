@@ -0,0 +1,261 @@
+#include "TransformHierarchy.h"
+#include <stdexcept>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define HIERARCHY_SSE
+#endif
+
+namespace
+{
+  enum NodeFlags : uint8_t
+  {
+    NodeAlive = 1,
+    NodeDirty = 2,     // Local TRS changed since the last Update
+    NodeQueued = 4     // Already bucketed by the running Update
+  };
+
+  /*
+   * out = a * b for column major matrices whose columns are 4 floats apart,
+   * columns of b are read up to inner rows. Each output column is a sum of
+   * a's columns scaled by one element of b, which maps straight onto SSE.
+   */
+  void MultiplyColumns(float const* a, float const* b, float* out, int columns, int inner)
+  {
+    for (int c = 0; c < columns; ++c)
+    {
+#if defined(HIERARCHY_SSE)
+      __m128 sum = _mm_mul_ps(_mm_loadu_ps(a), _mm_set1_ps(b[c * 4]));
+      for (int k = 1; k < inner; ++k)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a + k * 4), _mm_set1_ps(b[c * 4 + k])));
+      _mm_storeu_ps(out + c * 4, sum);
+#else
+      for (int row = 0; row < 4; ++row)
+      {
+        float sum = 0.0f;
+        for (int k = 0; k < inner; ++k)
+          sum += a[k * 4 + row] * b[c * 4 + k];
+        out[c * 4 + row] = sum;
+      }
+#endif
+    }
+  }
+
+  // The normal matrix of a product is the product of the normal matrices
+  void Combine(objectTransform const& parent, objectTransform const& local, objectTransform& out)
+  {
+    MultiplyColumns(&parent.model[0][0], &local.model[0][0], &out.model[0][0], 4, 4);
+    MultiplyColumns(&parent.normal[0][0], &local.normal[0][0], &out.normal[0][0], 3, 3);
+  }
+}
+
+uint32_t TransformHierarchy::Create(Transform const& local, uint32_t parent)
+{
+  if (parent != NoParent && Exists(parent) == false)
+    throw std::runtime_error("parent transform does not exist!");
+
+  uint32_t node;
+  if (freeNodes.empty() == false)
+  {
+    node = freeNodes.back();
+    freeNodes.pop_back();
+  }
+  else
+  {
+    node = static_cast<uint32_t>(parents.size());
+    positions.emplace_back();
+    rotations.emplace_back();
+    scales.emplace_back();
+    parents.push_back(NoParent);
+    firstChild.push_back(NoParent);
+    nextSibling.push_back(NoParent);
+    depths.push_back(0);
+    flags.push_back(0);
+    locals.emplace_back();
+    world.emplace_back();
+  }
+
+  positions[node] = local.position;
+  rotations[node] = local.rotation;
+  scales[node] = local.scale;
+  parents[node] = NoParent;
+  firstChild[node] = NoParent;
+  nextSibling[node] = NoParent;
+  flags[node] = NodeAlive;
+  if (parent != NoParent)
+    Link(node, parent);
+  depths[node] = (parent == NoParent) ? 0 : depths[parent] + 1;
+  MarkDirty(node);
+  return node;
+}
+
+void TransformHierarchy::Destroy(uint32_t node)
+{
+  // A second Destroy would put the id on the free list twice
+  if (Exists(node) == false)
+    throw std::runtime_error("transform does not exist!");
+  Unlink(node);
+  walk.clear();
+  walk.push_back(node);
+  while (walk.empty() == false)
+  {
+    uint32_t current = walk.back();
+    walk.pop_back();
+    for (uint32_t child = firstChild[current]; child != NoParent; child = nextSibling[child])
+      walk.push_back(child);
+    flags[current] = 0;
+    parents[current] = NoParent;
+    firstChild[current] = NoParent;
+    nextSibling[current] = NoParent;
+    freeNodes.push_back(current);
+  }
+}
+
+void TransformHierarchy::SetParent(uint32_t node, uint32_t parent)
+{
+  if (Exists(node) == false)
+    throw std::runtime_error("transform does not exist!");
+  if (parent != NoParent && Exists(parent) == false)
+    throw std::runtime_error("parent transform does not exist!");
+  if (parents[node] == parent)
+    return;
+  for (uint32_t above = parent; above != NoParent; above = parents[above])
+  {
+    if (above == node)
+      throw std::runtime_error("transform can't be parented below itself!");
+  }
+  Unlink(node);
+  if (parent != NoParent)
+    Link(node, parent);
+  UpdateDepth(node);
+  MarkDirty(node);
+}
+
+bool TransformHierarchy::Exists(uint32_t node) const
+{
+  return node < flags.size() && (flags[node] & NodeAlive) != 0;
+}
+
+void TransformHierarchy::SetLocal(uint32_t node, Transform const& local)
+{
+  positions[node] = local.position;
+  rotations[node] = local.rotation;
+  scales[node] = local.scale;
+  MarkDirty(node);
+}
+
+void TransformHierarchy::SetPosition(uint32_t node, glm::vec3 const& position)
+{
+  positions[node] = position;
+  MarkDirty(node);
+}
+
+void TransformHierarchy::SetRotation(uint32_t node, glm::vec3 const& rotation)
+{
+  rotations[node] = rotation;
+  MarkDirty(node);
+}
+
+void TransformHierarchy::SetScale(uint32_t node, glm::vec3 const& scale)
+{
+  scales[node] = scale;
+  MarkDirty(node);
+}
+
+void TransformHierarchy::MarkDirty(uint32_t node)
+{
+  if ((flags[node] & NodeDirty) == 0)
+  {
+    flags[node] |= NodeDirty;
+    dirtyNodes.push_back(node);
+  }
+}
+
+void TransformHierarchy::Link(uint32_t node, uint32_t parent)
+{
+  parents[node] = parent;
+  nextSibling[node] = firstChild[parent];
+  firstChild[parent] = node;
+}
+
+void TransformHierarchy::Unlink(uint32_t node)
+{
+  uint32_t parent = parents[node];
+  if (parent == NoParent)
+    return;
+  uint32_t* link = &firstChild[parent];
+  while (*link != node)
+    link = &nextSibling[*link];
+  *link = nextSibling[node];
+  nextSibling[node] = NoParent;
+  parents[node] = NoParent;
+}
+
+void TransformHierarchy::UpdateDepth(uint32_t node)
+{
+  walk.clear();
+  walk.push_back(node);
+  while (walk.empty() == false)
+  {
+    uint32_t current = walk.back();
+    walk.pop_back();
+    depths[current] = (parents[current] == NoParent) ? 0 : depths[parents[current]] + 1;
+    for (uint32_t child = firstChild[current]; child != NoParent; child = nextSibling[child])
+      walk.push_back(child);
+  }
+}
+
+void TransformHierarchy::Update(void)
+{
+  if (dirtyNodes.empty())
+    return;
+
+  // Only the changed nodes need their local transform rebuilt
+  for (uint32_t node : dirtyNodes)
+  {
+    if (flags[node] & NodeAlive)
+      locals[node] = GetLocal(node).GetObjectTransform();
+  }
+
+  // Bucket every dirty subtree by depth. A subtree already queued through a dirty ancestor is skipped
+  for (uint32_t node : dirtyNodes)
+  {
+    if ((flags[node] & NodeAlive) == 0 || (flags[node] & NodeQueued))
+      continue;
+    walk.clear();
+    walk.push_back(node);
+    while (walk.empty() == false)
+    {
+      uint32_t current = walk.back();
+      walk.pop_back();
+      if (flags[current] & NodeQueued)
+        continue;
+      flags[current] |= NodeQueued;
+      if (levels.size() <= depths[current])
+        levels.resize(depths[current] + 1);
+      levels[depths[current]].push_back(current);
+      for (uint32_t child = firstChild[current]; child != NoParent; child = nextSibling[child])
+        walk.push_back(child);
+    }
+  }
+
+  // Parents are a level above their children, so each level only reads finished transforms
+  for (std::vector<uint32_t>& level : levels)
+  {
+    for (uint32_t node : level)
+    {
+      uint32_t parent = parents[node];
+      if (parent == NoParent)
+        world[node] = locals[node];
+      else
+        Combine(world[parent], locals[node], world[node]);
+      flags[node] &= ~(NodeDirty | NodeQueued);
+    }
+    level.clear();
+  }
+
+  // Destroyed nodes that were dirty never got queued
+  for (uint32_t node : dirtyNodes)
+    flags[node] &= ~NodeDirty;
+  dirtyNodes.clear();
+}
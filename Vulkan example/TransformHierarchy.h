@@ -0,0 +1,75 @@
+#pragma once
+#include "Transform.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/*
+ * Persistent transforms for many objects, optionally parented to each other.
+ * Local position, rotation and scale are kept in separate arrays, the world
+ * transforms in one contiguous array indexed by node that can be handed to the
+ * GPU as it is. Changing a node marks it dirty and Update only recomputes the
+ * subtrees under dirty nodes, one depth level after another so parents are
+ * always done before their children. When nothing changed Update returns
+ * straight away, static objects cost nothing per frame.
+ */
+class TransformHierarchy
+{
+public:
+  static constexpr uint32_t NoParent = UINT32_MAX;
+
+  // Returns the new node, its world transform is valid after the next Update
+  uint32_t Create(Transform const& local = Transform{}, uint32_t parent = NoParent);
+  // Destroys the node and everything below it, their ids are handed out again by Create.
+  // Throws if the node doesn't exist
+  void Destroy(uint32_t node);
+  // Throws if either node doesn't exist, or parent is node or lies below it
+  void SetParent(uint32_t node, uint32_t parent);
+  uint32_t GetParent(uint32_t node) const { return parents[node]; }
+
+  void SetLocal(uint32_t node, Transform const& local);
+  void SetPosition(uint32_t node, glm::vec3 const& position);
+  void SetRotation(uint32_t node, glm::vec3 const& rotation);
+  void SetScale(uint32_t node, glm::vec3 const& scale);
+  Transform GetLocal(uint32_t node) const { return Transform{ positions[node], rotations[node], scales[node] }; }
+
+  // Recomputes the world transforms of every dirty node and its descendants
+  void Update(void);
+
+  // As of the last Update
+  objectTransform const& GetWorld(uint32_t node) const { return world[node]; }
+  // Indexed by node, destroyed nodes keep stale entries
+  std::span<const objectTransform> GetWorldTransforms(void) const { return world; }
+  size_t Size(void) const { return parents.size(); }
+  // False for ids out of range and destroyed nodes
+  bool Exists(uint32_t node) const;
+
+private:
+  void MarkDirty(uint32_t node);
+  void Link(uint32_t node, uint32_t parent);
+  void Unlink(uint32_t node);
+  // Sets depth below the node's parent for the node and its subtree
+  void UpdateDepth(uint32_t node);
+
+  // Local TRS
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> rotations;
+  std::vector<glm::vec3> scales;
+
+  // Links, children form a singly linked list through nextSibling
+  std::vector<uint32_t> parents;
+  std::vector<uint32_t> firstChild;
+  std::vector<uint32_t> nextSibling;
+  std::vector<uint32_t> depths;
+  std::vector<uint8_t> flags;
+
+  std::vector<objectTransform> locals;
+  std::vector<objectTransform> world;
+
+  // Nodes changed since the last Update
+  std::vector<uint32_t> dirtyNodes;
+  std::vector<uint32_t> freeNodes;
+  // Update scratch, the nodes to recompute bucketed by depth
+  std::vector<std::vector<uint32_t>> levels;
+  std::vector<uint32_t> walk;
+};
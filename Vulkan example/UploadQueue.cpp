@@ -0,0 +1,230 @@
+#include "UploadQueue.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Staging is allocated in chunks of this size, larger uploads get a chunk of their own
+constexpr VkDeviceSize StagingChunkSize = 4 * 1024 * 1024;
+
+UploadQueue::UploadQueue(void)
+{
+  device = VK_NULL_HANDLE;
+  allocator = VK_NULL_HANDLE;
+  timeline = nullptr;
+  transferFamily = 0;
+  graphicsFamily = 0;
+  pool = VK_NULL_HANDLE;
+  open = nullptr;
+}
+
+void UploadQueue::Create(VkDevice dev, VmaAllocator alloc, Timeline* transferTimeline, uint32_t transfer, uint32_t graphics)
+{
+  device = dev;
+  allocator = alloc;
+  timeline = transferTimeline;
+  transferFamily = transfer;
+  graphicsFamily = graphics;
+
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  poolInfo.queueFamilyIndex = transferFamily;
+  if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+    throw std::runtime_error("failed to create upload command pool!");
+}
+
+void UploadQueue::Destroy(void)
+{
+  if (device == VK_NULL_HANDLE)
+    return;
+  std::lock_guard<std::mutex> guard(lock);
+  if (open)
+  {
+    vkEndCommandBuffer(open->commandBuffer);
+    freeBatches.push_back(open);
+    open = nullptr;
+  }
+  for (uploadBatch* batch : inFlight)
+  {
+    timeline->Wait(batch->value);
+    freeBatches.push_back(batch);
+  }
+  inFlight.clear();
+  for (uploadBatch* batch : freeBatches)
+  {
+    DestroyStaging(*batch);
+    delete batch;
+  }
+  freeBatches.clear();
+  vkDestroyCommandPool(device, pool, nullptr);
+  pool = VK_NULL_HANDLE;
+  device = VK_NULL_HANDLE;
+}
+
+UploadQueue::uploadBatch* UploadQueue::OpenBatch(void)
+{
+  if (open)
+    return open;
+
+  uploadBatch* batch = nullptr;
+  if (freeBatches.empty() == false)
+  {
+    batch = freeBatches.back();
+    freeBatches.pop_back();
+    vkResetCommandBuffer(batch->commandBuffer, 0);
+  }
+  else
+  {
+    batch = new uploadBatch{};
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &batch->commandBuffer) != VK_SUCCESS)
+      throw std::runtime_error("failed to create upload batch!");
+  }
+
+  batch->acquires.clear();
+  batch->stages = 0;
+  batch->value = 0;
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(batch->commandBuffer, &beginInfo);
+  open = batch;
+  return batch;
+}
+
+stagingChunk* UploadQueue::AllocateStaging(uploadBatch& batch, VkDeviceSize size)
+{
+  // Copy offsets only need to be aligned for the widest thing a buffer holds
+  if (batch.staging.empty() == false)
+  {
+    stagingChunk& last = batch.staging.back();
+    VkDeviceSize head = (last.head + 15) & ~VkDeviceSize(15);
+    if (head + size <= last.size)
+    {
+      last.head = head;
+      return &last;
+    }
+  }
+
+  stagingChunk chunk{};
+  chunk.size = std::max(size, StagingChunkSize);
+  VkBufferCreateInfo stagingCreate{};
+  stagingCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  stagingCreate.size = chunk.size;
+  stagingCreate.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  stagingCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  VmaAllocationCreateInfo stagingAllocation{};
+  stagingAllocation.usage = VMA_MEMORY_USAGE_AUTO;
+  stagingAllocation.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VmaAllocationInfo stagingInfo;
+  if (vmaCreateBuffer(allocator, &stagingCreate, &stagingAllocation, &chunk.buffer, &chunk.memory, &stagingInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to create staging buffer!");
+  chunk.mapped = static_cast<char*>(stagingInfo.pMappedData);
+  batch.staging.push_back(chunk);
+  return &batch.staging.back();
+}
+
+void UploadQueue::DestroyStaging(uploadBatch& batch)
+{
+  for (stagingChunk& chunk : batch.staging)
+    vmaDestroyBuffer(allocator, chunk.buffer, chunk.memory);
+  batch.staging.clear();
+}
+
+void UploadQueue::Upload(VkBuffer dst, VkDeviceSize offset, void const* data, VkDeviceSize size, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  uploadBatch* batch = OpenBatch();
+  stagingChunk* chunk = AllocateStaging(*batch, size);
+  memcpy(chunk->mapped + chunk->head, data, size);
+  vmaFlushAllocation(allocator, chunk->memory, chunk->head, size);
+
+  VkBufferCopy region{};
+  region.srcOffset = chunk->head;
+  region.dstOffset = offset;
+  region.size = size;
+  vkCmdCopyBuffer(batch->commandBuffer, chunk->buffer, dst, 1, &region);
+  chunk->head += size;
+  batch->stages |= dstStages;
+
+  if (IsSeparateFamily() == false)
+    return;
+
+  // Exclusive buffers change families with a matching release and acquire
+  VkBufferMemoryBarrier transfer{};
+  transfer.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  transfer.srcQueueFamilyIndex = transferFamily;
+  transfer.dstQueueFamilyIndex = graphicsFamily;
+  transfer.buffer = dst;
+  transfer.offset = offset;
+  transfer.size = size;
+
+  VkBufferMemoryBarrier release = transfer;
+  release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  release.dstAccessMask = 0;
+  vkCmdPipelineBarrier(batch->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+
+  VkBufferMemoryBarrier acquire = transfer;
+  acquire.srcAccessMask = 0;
+  acquire.dstAccessMask = dstAccess;
+  batch->acquires.push_back(acquire);
+}
+
+bool UploadQueue::Submit(VkCommandBuffer acquire, uploadWait* wait)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  if (open == nullptr)
+    return false;
+  uploadBatch* batch = open;
+  open = nullptr;
+  vkEndCommandBuffer(batch->commandBuffer);
+
+  batch->value = timeline->Submit(&batch->commandBuffer, 1, timelineWaits{});
+  inFlight.push_back(batch);
+
+  // The acquires wait on the timeline at the stages that read the buffers
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(acquire, &beginInfo);
+  if (batch->acquires.empty() == false)
+    vkCmdPipelineBarrier(acquire, batch->stages, batch->stages, 0, 0, nullptr, static_cast<uint32_t>(batch->acquires.size()), batch->acquires.data(), 0, nullptr);
+  vkEndCommandBuffer(acquire);
+
+  wait->semaphore = timeline->Semaphore();
+  wait->value = batch->value;
+  wait->stages = batch->stages;
+  return true;
+}
+
+void UploadQueue::Collect(void)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  auto done = std::remove_if(inFlight.begin(), inFlight.end(), [&](uploadBatch* batch)
+    {
+      if (timeline->IsComplete(batch->value) == false)
+        return false;
+      // Only a standard sized chunk is kept around for the next batch
+      if (batch->staging.empty() == false && batch->staging[0].size == StagingChunkSize)
+      {
+        stagingChunk keep = batch->staging[0];
+        batch->staging.erase(batch->staging.begin());
+        DestroyStaging(*batch);
+        keep.head = 0;
+        batch->staging.push_back(keep);
+      }
+      else
+      {
+        DestroyStaging(*batch);
+      }
+      freeBatches.push_back(batch);
+      return true;
+    });
+  inFlight.erase(done, inFlight.end());
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <vulkan/vulkan.hpp>
+#include <vma/vk_mem_alloc.h>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include "Timeline.h"
+
+// Persistently mapped staging memory, uploads are packed into it back to back
+typedef struct stagingChunk
+{
+  VkBuffer buffer;
+  VmaAllocation memory;
+  char* mapped;
+  VkDeviceSize size;
+  VkDeviceSize head;
+}stagingChunk;
+
+// What the graphics submission consuming a batch has to wait on
+typedef struct uploadWait
+{
+  VkSemaphore semaphore;
+  uint64_t value;
+  VkPipelineStageFlags stages;
+}uploadWait;
+
+/*
+ * Copies data into device local buffers on the transfer queue. Uploads are
+ * staged and recorded as they come in, and every upload made between two
+ * Submit calls goes out in one batch. When the transfer queue is in its own
+ * family the batch releases the buffers to the graphics family and Submit
+ * records the matching acquires. Each batch signals a value on the transfer
+ * timeline the next graphics submission waits on, so the copies overlap with
+ * rendering. Staging memory is recycled once the timeline passed the batch.
+ * Upload may be called from any thread.
+ */
+class UploadQueue
+{
+public:
+  UploadQueue(void);
+
+  // timeline submits to the transfer queue
+  void Create(VkDevice device, VmaAllocator allocator, Timeline* timeline, uint32_t transferFamily, uint32_t graphicsFamily);
+  // Waits for every batch and frees all of them
+  void Destroy(void);
+
+  // Stages size bytes of data (copied before returning) to be written to dst at offset.
+  // dstStages and dstAccess describe how the graphics queue reads dst afterwards
+  void Upload(VkBuffer dst, VkDeviceSize offset, void const* data, VkDeviceSize size, VkPipelineStageFlags dstStages, VkAccessFlags dstAccess);
+
+  /*
+   * Submits the uploads made since the last call. Returns false if there were none.
+   * Otherwise the ownership acquires are recorded into acquire, which has to be
+   * submitted to the graphics queue ahead of anything using the buffers, waiting on
+   * wait.
+   */
+  bool Submit(VkCommandBuffer acquire, uploadWait* wait);
+
+  // Recycles the batches whose copies finished
+  void Collect(void);
+
+  bool IsSeparateFamily(void) const { return transferFamily != graphicsFamily; }
+
+private:
+  typedef struct uploadBatch
+  {
+    VkCommandBuffer commandBuffer;
+    std::vector<stagingChunk> staging;
+    std::vector<VkBufferMemoryBarrier> acquires;
+    VkPipelineStageFlags stages;
+    uint64_t value;       // Transfer timeline value signaled when the copies are done
+  }uploadBatch;
+
+  uploadBatch* OpenBatch(void);
+  stagingChunk* AllocateStaging(uploadBatch& batch, VkDeviceSize size);
+  void DestroyStaging(uploadBatch& batch);
+
+  VkDevice device;
+  VmaAllocator allocator;
+  Timeline* timeline;
+  uint32_t transferFamily;
+  uint32_t graphicsFamily;
+  VkCommandPool pool;
+  std::mutex lock;
+
+  // Batch being recorded, at most one at a time
+  uploadBatch* open;
+  std::vector<uploadBatch*> inFlight;
+  std::vector<uploadBatch*> freeBatches;
+};
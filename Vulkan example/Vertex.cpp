@@ -1,36 +1,196 @@
 #include "Vertex.h"
+#include "Transform.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 
-VertexInfo Vertex::GetInfo()
+// Per instance objectTransform on binding, model at locations 3 - 6 and normal matrix at 7 - 9
+static void AddInstanceStream(VertexInfo& info, uint32_t binding)
 {
+  VkVertexInputBindingDescription instanceBinding{};
+  instanceBinding.binding = binding;
+  instanceBinding.stride = sizeof(objectTransform);
+  instanceBinding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+  info.bindings.push_back(instanceBinding);
+
+  // A matrix input takes one location per column
+  for (uint32_t column = 0; column < 4; ++column)
+  {
+    VkVertexInputAttributeDescription ModelDescription{};
+    ModelDescription.binding = binding;
+    ModelDescription.location = 3 + column;
+    ModelDescription.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    ModelDescription.offset = offsetof(objectTransform, model) + sizeof(glm::vec4) * column;
+    info.attributes.push_back(ModelDescription);
+  }
+  // The normal matrix columns are padded to vec4, only xyz is read
+  for (uint32_t column = 0; column < 3; ++column)
+  {
+    VkVertexInputAttributeDescription NormalDescription{};
+    NormalDescription.binding = binding;
+    NormalDescription.location = 7 + column;
+    NormalDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
+    NormalDescription.offset = offsetof(objectTransform, normal) + sizeof(glm::vec4) * column;
+    info.attributes.push_back(NormalDescription);
+  }
+}
+
+namespace
+{
+  float SignNotZero(float v) { return (v >= 0.0f) ? 1.0f : -1.0f; }
+
+  int16_t ToSnorm16(float v)
+  {
+    return static_cast<int16_t>(std::round(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+  }
+
+  uint8_t ToUnorm8(float v)
+  {
+    return static_cast<uint8_t>(std::round(std::clamp(v, 0.0f, 1.0f) * 255.0f));
+  }
+
+  void PackColor(glm::vec4 const& color, uint8_t* dst)
+  {
+    for (int i = 0; i < 4; ++i)
+      dst[i] = ToUnorm8(color[i]);
+  }
+
+  // Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over the upper.
+  // A zero normal stays zero and decodes to +Z
+  void PackNormal(glm::vec3 const& n, int16_t* dst)
+  {
+    float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 oct = (length > 0.0f) ? glm::vec2(n.x, n.y) / length : glm::vec2(0.0f);
+    if (n.z < 0.0f)
+      oct = glm::vec2((1.0f - std::abs(oct.y)) * SignNotZero(oct.x), (1.0f - std::abs(oct.x)) * SignNotZero(oct.y));
+    dst[0] = ToSnorm16(oct.x);
+    dst[1] = ToSnorm16(oct.y);
+  }
+}
+
+PackedVertex PackedVertex::Pack(Vertex const& vert)
+{
+  PackedVertex packed;
+  packed.pos = vert.pos;
+  PackColor(vert.color, packed.color);
+  PackNormal(glm::vec3(vert.normal), packed.normal);
+  return packed;
+}
+
+void PackedVertex::Pack(PackedVertex* dst, Vertex const* src, size_t count)
+{
+  for (size_t i = 0; i < count; ++i)
+    dst[i] = Pack(src[i]);
+}
+
+void PackedVertex::Pack(PackedVertex* dst, vertexStreamView const& src)
+{
+  for (size_t i = 0; i < src.size(); ++i)
+  {
+    dst[i].pos = src.positions[i];
+    PackColor(src.colors[i], dst[i].color);
+    PackNormal(src.normals[i], dst[i].normal);
+  }
+}
+
+Vertex PackedVertex::Unpack() const
+{
+  Vertex vert;
+  vert.pos = pos;
+  for (int i = 0; i < 4; ++i)
+    vert.color[i] = color[i] / 255.0f;
+
+  // Same decode as the shaders
+  glm::vec2 oct = glm::max(glm::vec2(normal[0], normal[1]) / 32767.0f, glm::vec2(-1.0f));
+  glm::vec3 n = glm::vec3(oct, 1.0f - std::abs(oct.x) - std::abs(oct.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += (n.x >= 0.0f) ? -t : t;
+  n.y += (n.y >= 0.0f) ? -t : t;
+  vert.normal = glm::vec4(glm::normalize(n), 0);
+  return vert;
+}
+
+VertexStreams::VertexStreams(std::vector<Vertex> const& verts)
+{
+  reserve(verts.size());
+  for (Vertex const& vert : verts)
+    push_back(vert);
+}
+
+void VertexStreams::reserve(size_t count)
+{
+  positions.reserve(count);
+  colors.reserve(count);
+  normals.reserve(count);
+}
+
+void VertexStreams::clear()
+{
+  positions.clear();
+  colors.clear();
+  normals.clear();
+}
+
+void VertexStreams::push_back(Vertex const& vert)
+{
+  positions.push_back(vert.pos);
+  colors.push_back(vert.color);
+  normals.push_back(glm::vec3(vert.normal));
+}
+
+std::array<VkDeviceSize, VertexStreamCount> VertexStreams::GpuOffsets(size_t count)
+{
+  std::array<VkDeviceSize, VertexStreamCount> offsets{};
+  for (uint32_t stream = 1; stream < VertexStreamCount; ++stream)
+    offsets[stream] = offsets[stream - 1] + GpuStrides[stream - 1] * count;
+  return offsets;
+}
+
+void VertexStreams::Pack(vertexStreamView const& src, void* dst)
+{
+  std::array<VkDeviceSize, VertexStreamCount> offsets = GpuOffsets(src.size());
+  char* bytes = static_cast<char*>(dst);
+  memcpy(bytes + offsets[PositionStream], src.positions.data(), sizeof(glm::vec3) * src.size());
+  uint8_t* color = reinterpret_cast<uint8_t*>(bytes + offsets[ColorStream]);
+  int16_t* normal = reinterpret_cast<int16_t*>(bytes + offsets[NormalStream]);
+  for (size_t i = 0; i < src.size(); ++i)
+  {
+    PackColor(src.colors[i], color + i * 4);
+    PackNormal(src.normals[i], normal + i * 2);
+  }
+}
+
+VertexInfo VertexStreams::GetInfo(uint32_t streamMask)
+{
+  // Formats match the packed streams, strides are only placeholders for the dynamic ones
+  static constexpr std::array<VkFormat, VertexStreamCount> formats = {
+    VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16_SNORM };
+
   VertexInfo info;
-  VkVertexInputBindingDescription bindingDescriptions{};
-  bindingDescriptions.binding = 0;
-  bindingDescriptions.stride = sizeof(Vertex);
-  bindingDescriptions.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-  info.bindings.push_back(bindingDescriptions);
-
-  VkVertexInputAttributeDescription PositionDescription{};
-  PositionDescription.binding = 0;
-  PositionDescription.location = 0;
-  PositionDescription.format = VK_FORMAT_R32G32B32_SFLOAT;
-  PositionDescription.offset = offsetof(Vertex, pos);
-
-  VkVertexInputAttributeDescription ColorDescription{};
-  ColorDescription.binding = 0;
-  ColorDescription.location = 1;
-  ColorDescription.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-  ColorDescription.offset = offsetof(Vertex, color);
-
-  VkVertexInputAttributeDescription NormalDescription{};
-  NormalDescription.binding = 0;
-  NormalDescription.location = 2;
-  NormalDescription.format = VK_FORMAT_R32G32B32A32_SFLOAT;
-  NormalDescription.offset = offsetof(Vertex, normal);
-
-  info.attributes.push_back(PositionDescription);
-  info.attributes.push_back(ColorDescription);
-  info.attributes.push_back(NormalDescription);
+  for (uint32_t stream = 0; stream < VertexStreamCount; ++stream)
+  {
+    if ((streamMask & (1u << stream)) == 0)
+      continue;
+    VkVertexInputBindingDescription bindingDescription{};
+    bindingDescription.binding = stream;
+    bindingDescription.stride = static_cast<uint32_t>(GpuStrides[stream]);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    info.bindings.push_back(bindingDescription);
+
+    VkVertexInputAttributeDescription attributeDescription{};
+    attributeDescription.binding = stream;
+    attributeDescription.location = stream;
+    attributeDescription.format = formats[stream];
+    attributeDescription.offset = 0;
+    info.attributes.push_back(attributeDescription);
+  }
+  return info;
+}
 
+VertexInfo VertexStreams::GetInstancedInfo(uint32_t streamMask)
+{
+  VertexInfo info = GetInfo(streamMask);
+  AddInstanceStream(info, InstanceBinding);
   return info;
-}
\ No newline at end of file
+}
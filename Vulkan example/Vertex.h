@@ -5,6 +5,9 @@
 #include <SDL2/SDL_vulkan.h>
 #include <vulkan/vulkan.hpp>
 #include <vma/vk_mem_alloc.h>
+#include <array>
+#include <span>
+#include <vector>
 struct VertexInfo
 {
   std::vector<VkVertexInputBindingDescription> bindings;
@@ -19,8 +22,6 @@ struct Vertex
   glm::vec4 color;
   glm::vec4 normal;
 
-  static VertexInfo GetInfo();
-
   static std::array<VkVertexInputBindingDescription, 1> getBindingDescriptions() {
     static std::array<VkVertexInputBindingDescription, 1> bindingDescriptions{};
     bindingDescriptions[0].binding = 0;
@@ -49,4 +50,89 @@ struct Vertex
 
     return attributeDescriptions;
   }
-};
\ No newline at end of file
+};
+
+// Read only view of separate vertex streams, all the same length
+typedef struct vertexStreamView
+{
+  std::span<const glm::vec3> positions;
+  std::span<const glm::vec4> colors;
+  std::span<const glm::vec3> normals;
+
+  size_t size() const { return positions.size(); }
+  bool empty() const { return positions.empty(); }
+  Vertex Get(size_t i) const { return Vertex{ positions[i], colors[i], glm::vec4(normals[i], 0) }; }
+}vertexStreamView;
+
+/*
+ * The interleaved layout transient vertices have on the GPU, 20 bytes instead
+ * of Vertex's 44.
+ * Color is RGBA8 UNORM and the normal is octahedral encoded into two SNORM16s,
+ * which the shaders decode. Only the normal's direction is kept, the shaders
+ * normalized it anyway. Position stays float, meshes are placed in world space
+ * by a model matrix that can scale them by a lot.
+ */
+struct PackedVertex
+{
+  glm::vec3 pos;
+  uint8_t color[4];
+  int16_t normal[2];
+
+  static PackedVertex Pack(Vertex const& vert);
+  static void Pack(PackedVertex* dst, Vertex const* src, size_t count);
+  static void Pack(PackedVertex* dst, vertexStreamView const& src);
+  Vertex Unpack() const;
+};
+
+// Each vertex attribute is its own binding, numbered like the location the shaders read it from
+enum VertexStream
+{
+  PositionStream = 0,
+  ColorStream = 1,
+  NormalStream = 2,
+  VertexStreamCount
+};
+constexpr uint32_t PositionStreamMask = 1u << PositionStream;
+constexpr uint32_t AllStreamsMask = (1u << VertexStreamCount) - 1;
+// Per instance data is bound after the vertex streams
+constexpr uint32_t InstanceBinding = VertexStreamCount;
+
+/*
+ * Geometry kept as one array per attribute, so anything that only needs
+ * positions never touches the rest. On the GPU the streams are packed back
+ * to back in one buffer, float3 positions, then RGBA8 colors, then octahedral
+ * SNORM16x2 normals, the same encodings as PackedVertex. Binding strides are
+ * dynamic pipeline state, which lets interleaved PackedVertex data be bound to
+ * the same pipelines by pointing every stream into one buffer.
+ */
+struct VertexStreams
+{
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec4> colors;
+  std::vector<glm::vec3> normals;
+
+  VertexStreams() = default;
+  explicit VertexStreams(std::vector<Vertex> const& verts);
+
+  size_t size() const { return positions.size(); }
+  bool empty() const { return positions.empty(); }
+  void reserve(size_t count);
+  void clear();
+  void push_back(Vertex const& vert);
+  Vertex Get(size_t i) const { return View().Get(i); }
+  vertexStreamView View() const { return { positions, colors, normals }; }
+
+  // Bytes per vertex of each packed stream
+  static constexpr std::array<VkDeviceSize, VertexStreamCount> GpuStrides = { sizeof(glm::vec3), 4, 4 };
+  // Offset of each stream in a buffer holding count vertices
+  static std::array<VkDeviceSize, VertexStreamCount> GpuOffsets(size_t count);
+  static VkDeviceSize GpuSize(size_t count) { return count * sizeof(PackedVertex); }
+  // Writes GpuSize(src.size()) bytes to dst
+  static void Pack(vertexStreamView const& src, void* dst);
+
+  // Vertex input for the streams in streamMask
+  static VertexInfo GetInfo(uint32_t streamMask);
+  // GetInfo plus the per instance objectTransform on InstanceBinding, model at locations 3 - 6
+  // and normal matrix at 7 - 9
+  static VertexInfo GetInstancedInfo(uint32_t streamMask);
+};
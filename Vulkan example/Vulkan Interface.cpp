@@ -1,6 +1,10 @@
 #include "Vulkan Interface.h"
+#include "MeshData.h"
+#include "CpuProfiler.h"
+#include <unordered_map>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #ifdef _DEBUG
 #include <Windows.h>
 #include <iostream>
@@ -21,6 +25,24 @@ namespace pass
 
 
 
+TopoClass getTopologyClass(VkPrimitiveTopology topology)
+{
+  switch (topology)
+  {
+  case 0:
+    return Point;
+  case 1:
+  case 2:
+    return Line;
+  case 3:
+  case 4:
+  case 5:
+    return Triangle;
+  default:
+    return Triangle;
+  }
+}
+
 VulkanInterface::VulkanInterface(void) : lightInformation({ 0,0,0,1 }, 100000)
 {
   _swapChain = 0;
@@ -30,24 +52,70 @@ VulkanInterface::VulkanInterface(void) : lightInformation({ 0,0,0,1 }, 100000)
   globalWindow = 0;
   physicalDevice = 0;
   pool = 0;
-  fence = 0;
   imageIndex = 0;
-  presentSemaphore = 0;
-  imageGet = 0;
+  frames = {};
   activeCamera = { 45, {0,0,0}, {0, 0, 0} };
   constantBuffer.worldProjection = glm::identity<glm::mat4x4>();
-  constantBuffer.objectPosition = glm::identity<glm::mat4x4>();
+  drawConstant = Transform{}.GetObjectTransform();
   pipelayout = nullptr;
   primaryBuffer = nullptr;
   surfaceCapabilities = { 0 };
   surfaceFormat = { VK_FORMAT_UNDEFINED };
   windowSize = { 1280, 720 };
+  renderExtent = { 1280, 720 };
   pass::interface = this;
-  activePipeline = Triangle;
+  activeVariant = StandardPipeline;
+  activeTopology = Triangle;
+  boundPipeline = VK_NULL_HANDLE;
+  currentTopology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  descriptorSetLayout = VK_NULL_HANDLE;
+  descriptorPool = VK_NULL_HANDLE;
 }
 
 VulkanInterface::~VulkanInterface(void)
 {
+  // Outstanding pipeline builds finish before anything they use goes away
+  buildPool.Destroy();
+  if (globalDevice)
+  {
+    vkDeviceWaitIdle(globalDevice);
+    recordPool.Destroy();
+    gpuTimer.Destroy();
+    pipelineCache.Destroy();
+    shaderRegistry.Destroy();
+    transientRing.Destroy();
+    uploadQueue.Destroy();
+    ReleaseRetiredBuffers(true);
+    vkDestroyDescriptorPool(globalDevice, descriptorPool, nullptr);
+    DestroyRetiredSwapchains(true);
+    vkDestroyImageView(globalDevice, depthView, nullptr);
+    vmaDestroyImage(allocator, depthImage, depthMemory);
+    for (uint32_t i = 0; i < framesInFlight; ++i)
+    {
+      currentFrame = i;
+      ReleaseActiveBuffers();
+      if (frames[i].objectBuffer.buffer)
+        ReleaseVertexBuffer(frames[i].objectBuffer);
+      if (frames[i].indirectBuffer.buffer)
+        ReleaseVertexBuffer(frames[i].indirectBuffer);
+      if (frames[i].uniforms.buffer)
+        ReleaseVertexBuffer(frames[i].uniforms);
+      vkDestroySemaphore(globalDevice, frames[i].imageGet, nullptr);
+      for (VkCommandPool commandPool : frames[i].recordPools)
+        vkDestroyCommandPool(globalDevice, commandPool, nullptr);
+    }
+    transferTimeline.Destroy();
+    graphicsTimeline.Destroy();
+  }
+  if (headless)
+  {
+    for (size_t i = 0; i < _swapImages.size(); ++i)
+      vmaDestroyImage(allocator, _swapImages[i], _offscreenMemory[i]);
+    instance.destroy();
+    return;
+  }
+  for (VkSemaphore semaphore : _presentSemaphores)
+    vkDestroySemaphore(globalDevice, semaphore, nullptr);
   vkDestroySwapchainKHR(globalDevice, _swapChain, nullptr);
 
   instance.destroySurfaceKHR(surface);
@@ -58,6 +126,31 @@ VulkanInterface::~VulkanInterface(void)
 
 void VulkanInterface::Initialize(void)
 {
+  if (headless)
+  {
+    // Same setup without anything that needs a display
+    CreateInstance();
+    CreatePhysicalDevice();
+    CreateDevice();
+    CreateMemoryAllocator();
+    CreateOffscreenTargets();
+    CreateImageView();
+    CreateDepthTarget();
+    CreateRenderPass();
+    CreateFrameBuffer();
+    CreateCommandBuffer();
+    uploadQueue.Create(globalDevice, allocator, transferTimeline.IsCreated() ? &transferTimeline : &graphicsTimeline, transferFamily, graphicsFamily);
+    CreateShaderRegistry();
+    pipelineCache.Create(globalDevice, physicalDevice, pipelineCachePath);
+    CreateGraphicsPipeline();
+    CreateSyncObjects();
+    CreateTransientRing();
+    CreateFrameDescriptors();
+    CreateRecordingPools();
+    gpuTimer.Create(globalDevice, physicalDevice, GraphicsFamily(), framesInFlight, MaxGpuScopes);
+    return;
+  }
+
   // Create an SDL window that supports Vulkan rendering.
   if (SDL_Init(SDL_INIT_VIDEO) != 0) {
     std::cout << "Could not initialize SDL." << std::endl;
@@ -66,7 +159,7 @@ void VulkanInterface::Initialize(void)
 
 
   SDL_Window* window = SDL_CreateWindow("Vulkan Window", SDL_WINDOWPOS_CENTERED,
-    SDL_WINDOWPOS_CENTERED, 1280, 720, SDL_WINDOW_VULKAN);
+    SDL_WINDOWPOS_CENTERED, 1280, 720, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
   if (window == NULL) {
     std::cout << "Could not create SDL window." << std::endl;
     return;
@@ -80,20 +173,81 @@ void VulkanInterface::Initialize(void)
   CreateMemoryAllocator();
   CreateSwapChain();
   CreateImageView();
+  CreateDepthTarget();
   CreateRenderPass();
   CreateFrameBuffer();
   CreateCommandBuffer();
+  uploadQueue.Create(globalDevice, allocator, transferTimeline.IsCreated() ? &transferTimeline : &graphicsTimeline, transferFamily, graphicsFamily);
+  CreateShaderRegistry();
+  pipelineCache.Create(globalDevice, physicalDevice, pipelineCachePath);
   CreateGraphicsPipeline();
-  VkFenceCreateInfo fenceCreate{};
-  fenceCreate.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fenceCreate.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-  vkCreateFence(globalDevice, &fenceCreate, nullptr, &fence);
+  CreateSyncObjects();
+  CreateTransientRing();
+  CreateFrameDescriptors();
+  CreateRecordingPools();
+  gpuTimer.Create(globalDevice, physicalDevice, GraphicsFamily(), framesInFlight, MaxGpuScopes);
+}
 
-  VkSemaphoreCreateInfo presentSema{};
-  presentSema.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  vkCreateSemaphore(globalDevice, &presentSema, nullptr, &presentSemaphore);
-  vkCreateSemaphore(globalDevice, &presentSema, nullptr, &imageGet);
+void VulkanInterface::SetHeadless(uint32_t width, uint32_t height)
+{
+  if (globalDevice)
+    throw std::runtime_error("Headless mode must be set before Initialize");
+  headless = true;
+  renderExtent = { width, height };
+}
 
+void VulkanInterface::SetPipelineCachePath(std::string const& path)
+{
+  if (globalDevice)
+    throw std::runtime_error("Pipeline cache path must be set before Initialize");
+  pipelineCachePath = path;
+}
+
+void VulkanInterface::SetShaderPackPath(std::string const& path)
+{
+  if (globalDevice)
+    throw std::runtime_error("Shader pack path must be set before Initialize");
+  shaderPackPath = path;
+}
+
+void VulkanInterface::SetDepthFormat(VkFormat format)
+{
+  if (globalDevice)
+    throw std::runtime_error("Depth format must be set before Initialize");
+  depthFormat = format;
+}
+
+void VulkanInterface::SetReverseZ(bool enabled)
+{
+  if (globalDevice)
+    throw std::runtime_error("Reverse Z must be set before Initialize");
+  reverseZ = enabled;
+}
+
+void VulkanInterface::SetDepthPrePass(bool enabled)
+{
+  if (globalDevice)
+    throw std::runtime_error("Depth pre-pass must be set before Initialize");
+  depthPrePass = enabled;
+}
+
+void VulkanInterface::CreateShaderRegistry(void)
+{
+  shaderRegistry.Create(globalDevice);
+  // A missing pack is fine, the shaders still come from the binary or disk
+  if (shaderPackPath.empty() == false)
+    shaderRegistry.MapPack(shaderPackPath);
+}
+
+void VulkanInterface::SetFramesInFlight(uint32_t count)
+{
+  if (globalDevice)
+    throw std::runtime_error("Frames in flight must be set before Initialize");
+  if (count < 1)
+    count = 1;
+  if (count > MaxFramesInFlight)
+    count = MaxFramesInFlight;
+  framesInFlight = count;
 }
 
 
@@ -107,15 +261,19 @@ void add_extension(unsigned int* count, std::vector<const char*>* extensions, co
 void VulkanInterface::CreateInstance(void)
 {
   // Get WSI extensions from SDL (we can add more if we like - we just can't remove these)
-  unsigned extension_count;
-  if (!SDL_Vulkan_GetInstanceExtensions(globalWindow, &extension_count, NULL)) {
-    std::cout << "Could not get the number of required instance extensions from SDL." << std::endl;
-    return;
-  }
-  std::vector<const char*> extensions(extension_count);
-  if (!SDL_Vulkan_GetInstanceExtensions(globalWindow, &extension_count, extensions.data())) {
-    std::cout << "Could not get the names of required instance extensions from SDL." << std::endl;
-    return;
+  unsigned extension_count = 0;
+  std::vector<const char*> extensions;
+  if (headless == false)
+  {
+    if (!SDL_Vulkan_GetInstanceExtensions(globalWindow, &extension_count, NULL)) {
+      std::cout << "Could not get the number of required instance extensions from SDL." << std::endl;
+      return;
+    }
+    extensions.resize(extension_count);
+    if (!SDL_Vulkan_GetInstanceExtensions(globalWindow, &extension_count, extensions.data())) {
+      std::cout << "Could not get the names of required instance extensions from SDL." << std::endl;
+      return;
+    }
   }
   //add_extension(&extension_count, &extensions, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
   // Use validation layers if this is a debug build
@@ -200,67 +358,113 @@ void VulkanInterface::CreatePhysicalDevice(void)
 void VulkanInterface::CreateDevice(void)
 {
 
-  const float priorities[2] = { 0, 1 };
-  VkQueueFamilyProperties properites = {};
-  properites.queueCount = 1;
-  properites.minImageTransferGranularity = { 1,1,1 };
-  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, &properites);
-  VkDeviceQueueCreateInfo* queueCreate = nullptr;
-  if (queueCount != 0)
-  {
-    // This is where most initializtion for a program should be performed
-    VkDeviceQueueCreateInfo deviceQueueCreate[2] = { {} };
-    deviceQueueCreate[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreate[0].queueFamilyIndex = 0; // Transfer
-    deviceQueueCreate[0].queueCount = 1;
-    deviceQueueCreate[0].pQueuePriorities = priorities;
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
 
-    deviceQueueCreate[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreate[1].queueFamilyIndex = queueCount; // Graphics
-    deviceQueueCreate[1].queueCount = 1;
-    deviceQueueCreate[1].pQueuePriorities = priorities;
-    queueCreate = deviceQueueCreate;
+  // Graphics goes on the first family that can also present
+  graphicsFamily = UINT32_MAX;
+  for (uint32_t i = 0; i < familyCount && graphicsFamily == UINT32_MAX; ++i)
+  {
+    if ((families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) == 0)
+      continue;
+    VkBool32 present = VK_TRUE;
+    if (headless == false)
+      vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &present);
+    if (present)
+      graphicsFamily = i;
   }
-  else
+  if (graphicsFamily == UINT32_MAX)
+    throw std::runtime_error("failed to find a graphics queue!");
+
+  // Uploads prefer a family that does nothing but transfers, those are the DMA engines
+  transferFamily = graphicsFamily;
+  int bestScore = 0;
+  for (uint32_t i = 0; i < familyCount; ++i)
   {
-    VkDeviceQueueCreateInfo deviceQueueCreate = {};
-    deviceQueueCreate.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    deviceQueueCreate.queueFamilyIndex = queueCount; // Graphics
-    deviceQueueCreate.queueCount = 1;
-    deviceQueueCreate.pQueuePriorities = priorities;
-    queueCreate = &deviceQueueCreate;
+    VkQueueFlags flags = families[i].queueFlags;
+    if (i == graphicsFamily || (flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == 0)
+      continue;
+    int score = (flags & VK_QUEUE_GRAPHICS_BIT) ? 1 : (flags & VK_QUEUE_COMPUTE_BIT) ? 2 : 3;
+    if (score > bestScore)
+    {
+      bestScore = score;
+      transferFamily = i;
+    }
   }
+  // Without one a second queue of the graphics family still runs alongside
+  uint32_t transferIndex = 0;
+  if (transferFamily == graphicsFamily && families[graphicsFamily].queueCount > 1)
+    transferIndex = 1;
+
+  const float priorities[2] = { 1, 1 };
+  VkDeviceQueueCreateInfo queueCreate[2] = { {} };
+  queueCreate[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queueCreate[0].queueFamilyIndex = graphicsFamily;
+  queueCreate[0].queueCount = 1 + transferIndex;
+  queueCreate[0].pQueuePriorities = priorities;
+
+  queueCreate[1].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+  queueCreate[1].queueFamilyIndex = transferFamily;
+  queueCreate[1].queueCount = 1;
+  queueCreate[1].pQueuePriorities = priorities;
+  uint32_t queueCreateCount = (transferFamily != graphicsFamily) ? 2 : 1;
 
   std::vector<const char*> extensions = std::vector<const char*>();
-  add_extension(nullptr, &extensions, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  if (headless == false)
+    add_extension(nullptr, &extensions, VK_KHR_SWAPCHAIN_EXTENSION_NAME);
   VkDeviceCreateInfo deviceCreate = {};
   deviceCreate.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
   deviceCreate.pQueueCreateInfos = queueCreate;
-  deviceCreate.queueCreateInfoCount = (queueCount != 0) ? 2 : 1;
+  deviceCreate.queueCreateInfoCount = queueCreateCount;
   deviceCreate.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
   deviceCreate.ppEnabledExtensionNames = extensions.data();
 
-  vkCreateDevice(physicalDevice, &deviceCreate, nullptr, &globalDevice);
+  // Only turn on the optional features we can make use of
+  VkPhysicalDeviceFeatures supported{};
+  vkGetPhysicalDeviceFeatures(physicalDevice, &supported);
+  VkPhysicalDeviceFeatures enabled{};
+  enabled.multiDrawIndirect = supported.multiDrawIndirect;
+  // Indirect commands carry the object index in firstInstance
+  enabled.drawIndirectFirstInstance = supported.drawIndirectFirstInstance;
+  deviceCreate.pEnabledFeatures = &enabled;
+
+  // Frame and upload synchronization is built on timeline semaphores, core since 1.2
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  VkPhysicalDeviceVulkan12Features supported12{};
+  supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  VkPhysicalDeviceFeatures2 supported2{};
+  supported2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supported2.pNext = &supported12;
+  if (properties.apiVersion >= VK_API_VERSION_1_2)
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &supported2);
+  if (supported12.timelineSemaphore == VK_FALSE)
+    throw std::runtime_error("timeline semaphores are not supported!");
+  VkPhysicalDeviceVulkan12Features enabled12{};
+  enabled12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+  enabled12.timelineSemaphore = VK_TRUE;
+  deviceCreate.pNext = &enabled12;
+
+  multiDrawSupported = supported.multiDrawIndirect == VK_TRUE;
+  maxDrawIndirectCount = multiDrawSupported ? properties.limits.maxDrawIndirectCount : 1;
+  indirectFirstInstance = supported.drawIndirectFirstInstance == VK_TRUE;
 
-  VkQueue graphicsQueue0 = VK_NULL_HANDLE;
-  VkQueue graphicsQueue1 = VK_NULL_HANDLE;
-  VkQueue transferQueue0 = VK_NULL_HANDLE;
-  if (queueCount != 0)
-  {
-    // Can be obtained in any order
-    vkGetDeviceQueue(globalDevice, 0, 0, &transferQueue0); // family 0 - queue 0
-    vkGetDeviceQueue(globalDevice, 1, 1, &graphicsQueue1); // family 1 - queue 1
-    vkGetDeviceQueue(globalDevice, 1, 0, &graphicsQueue0); // family 1 - queue 0
-    queues.push_back(graphicsQueue0);
-    queues.push_back(graphicsQueue1);
-    queues.push_back(transferQueue0);
+  vkCreateDevice(physicalDevice, &deviceCreate, nullptr, &globalDevice);
 
-  }
-  else
-  {
-    vkGetDeviceQueue(globalDevice, 0, 0, &graphicsQueue0); // family 1 - queue 0
-    queues.push_back(graphicsQueue0);
-  }
+  // queues[0] renders and presents, queues[1] takes the uploads
+  VkQueue graphicsQueue = VK_NULL_HANDLE;
+  VkQueue transferQueue = VK_NULL_HANDLE;
+  vkGetDeviceQueue(globalDevice, graphicsFamily, 0, &graphicsQueue);
+  vkGetDeviceQueue(globalDevice, transferFamily, transferIndex, &transferQueue);
+  queues.push_back(graphicsQueue);
+  queues.push_back(transferQueue);
+
+  graphicsTimeline.Create(globalDevice, graphicsQueue);
+  // A lone queue keeps a single timeline, its values then order every submission
+  if (transferQueue != graphicsQueue)
+    transferTimeline.Create(globalDevice, transferQueue);
 }
 
 void VulkanInterface::CreateMemoryAllocator(void)
@@ -276,63 +480,153 @@ void VulkanInterface::CreateMemoryAllocator(void)
 
 void VulkanInterface::CreateRenderPass(void)
 {
-  VkAttachmentDescription attachments[1] = {}; // 3638
+  VkAttachmentDescription attachments[2] = {}; // 3638
   VkAttachmentReference Attachments[1] = {
     {0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL },
   };
+  VkAttachmentReference depthAttachment = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
   attachments[0].format = surfaceFormat.format;
   attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
   attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
   attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  attachments[0].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // Offscreen targets are left ready to be copied out
+  attachments[0].finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
   attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
   attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 
-  //attachments[1].format = surfaceFormats[0].format;
-  //attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
-  //attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-  //attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE;
-  //attachments[1].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-  //attachments[1].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-  //attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-  //attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-  VkSubpassDescription subDescription = {};
+  // Depth never outlives the pass, so it is neither loaded nor stored
+  attachments[1].format = depthFormat;
+  attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+  attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+  // With the pre-pass, subpass 0 only writes depth and subpass 1 shades against it
+  std::array<VkSubpassDescription, 2> subDescriptions = {};
+  subDescriptions[0].colorAttachmentCount = 0;
+  subDescriptions[0].pDepthStencilAttachment = &depthAttachment;
+  subDescriptions[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+
+  VkSubpassDescription& subDescription = subDescriptions[ColorSubpass()];
   subDescription.colorAttachmentCount = 1;
   subDescription.pColorAttachments = Attachments;
+  subDescription.pDepthStencilAttachment = &depthAttachment;
   subDescription.preserveAttachmentCount = 0;
   subDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  std::array<VkSubpassDependency, 1> dependencies{};
+  std::vector<VkSubpassDependency> dependencies(3);
 
-  dependencies[0].srcSubpass = 0;
-  dependencies[0].dstSubpass = 0;
+  dependencies[0].srcSubpass = ColorSubpass();
+  dependencies[0].dstSubpass = ColorSubpass();
   dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
   dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
   dependencies[0].srcAccessMask = 0;
   dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
   dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-  //dependencies[1].srcSubpass = 0;
-  //dependencies[1].dstSubpass = 0;
-  //dependencies[1].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-  //dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  //dependencies[1].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  //dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-  //dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+  // The color attachment waits for the acquired image, the depth attachment for the
+  // previous frame's depth writes since every frame shares the one depth image
+  dependencies[1].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[1].dstSubpass = ColorSubpass();
+  dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  dependencies[1].srcAccessMask = 0;
+  dependencies[1].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+
+  dependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+  dependencies[2].dstSubpass = 0;
+  dependencies[2].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[2].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependencies[2].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependencies[2].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+
+  if (depthPrePass)
+  {
+    // Shading only starts on a region once its depth is final
+    VkSubpassDependency prePass{};
+    prePass.srcSubpass = 0;
+    prePass.dstSubpass = 1;
+    prePass.srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    prePass.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    prePass.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    prePass.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    prePass.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    dependencies.push_back(prePass);
+  }
 
   VkRenderPassCreateInfo renderPassCreate{};
   renderPassCreate.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassCreate.subpassCount = 1;
-  renderPassCreate.pSubpasses = &subDescription;
+  renderPassCreate.subpassCount = depthPrePass ? 2 : 1;
+  renderPassCreate.pSubpasses = subDescriptions.data();
   renderPassCreate.pAttachments = attachments;
-  renderPassCreate.attachmentCount = 1;
+  renderPassCreate.attachmentCount = 2;
   renderPassCreate.dependencyCount = static_cast<uint32_t>(dependencies.size());
   renderPassCreate.pDependencies = dependencies.data();
 
   vkCreateRenderPass(globalDevice, &renderPassCreate, nullptr, &currentRenderPass);
 }
 
+VkFormat VulkanInterface::SelectDepthFormat(void)
+{
+  // Float depth first, reverse Z depends on it
+  const VkFormat candidates[] = {
+    depthFormat,
+    VK_FORMAT_D32_SFLOAT,
+    VK_FORMAT_D32_SFLOAT_S8_UINT,
+    VK_FORMAT_X8_D24_UNORM_PACK32,
+    VK_FORMAT_D24_UNORM_S8_UINT,
+    VK_FORMAT_D16_UNORM
+  };
+  for (VkFormat format : candidates)
+  {
+    if (format == VK_FORMAT_UNDEFINED)
+      continue;
+    VkFormatProperties properties{};
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+    if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+      return format;
+  }
+  throw std::runtime_error("failed to find a supported depth format!");
+}
+
+void VulkanInterface::CreateDepthTarget(void)
+{
+  depthFormat = SelectDepthFormat();
+
+  VkImageCreateInfo imageCreate{};
+  imageCreate.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageCreate.imageType = VK_IMAGE_TYPE_2D;
+  imageCreate.format = depthFormat;
+  imageCreate.extent = { renderExtent.width, renderExtent.height, 1 };
+  imageCreate.mipLevels = 1;
+  imageCreate.arrayLayers = 1;
+  imageCreate.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageCreate.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageCreate.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  imageCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageCreate.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+  if (vmaCreateImage(allocator, &imageCreate, &allocationInfo, &depthImage, &depthMemory, nullptr) != VK_SUCCESS)
+    throw std::runtime_error("failed to create depth target!");
+
+  bool hasStencil = depthFormat == VK_FORMAT_D32_SFLOAT_S8_UINT || depthFormat == VK_FORMAT_D24_UNORM_S8_UINT || depthFormat == VK_FORMAT_D16_UNORM_S8_UINT;
+  VkImageViewCreateInfo viewCreate{};
+  viewCreate.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewCreate.image = depthImage;
+  viewCreate.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewCreate.format = depthFormat;
+  viewCreate.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencil ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+  viewCreate.subresourceRange.levelCount = 1;
+  viewCreate.subresourceRange.layerCount = 1;
+  if (vkCreateImageView(globalDevice, &viewCreate, nullptr, &depthView) != VK_SUCCESS)
+    throw std::runtime_error("failed to create depth target view!");
+}
+
 VkSurfaceFormatKHR VulkanInterface::SelectValidFormat(std::vector<VkSurfaceFormatKHR>& formats)
 {
   for (auto &format : formats)
@@ -345,19 +639,32 @@ VkSurfaceFormatKHR VulkanInterface::SelectValidFormat(std::vector<VkSurfaceForma
 
 void VulkanInterface::CreateSwapChain(void)
 {
-  std::vector<VkSurfaceFormatKHR> surfaceFormats(5);
-  uint32_t cout = static_cast<uint32_t>(surfaceFormats.size());
-  vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &cout, surfaceFormats.data());
+  // The format is only picked once, the render pass and pipelines are built for it
+  if (surfaceFormat.format == VK_FORMAT_UNDEFINED)
+  {
+    uint32_t cout = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &cout, nullptr);
+    std::vector<VkSurfaceFormatKHR> surfaceFormats(cout);
+    vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &cout, surfaceFormats.data());
+    surfaceFormat = SelectValidFormat(surfaceFormats);
+  }
   vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
-  surfaceFormat = SelectValidFormat(surfaceFormats);
+  renderExtent = SelectExtent();
+  presentMode = SelectPresentMode();
+
+  // maxImageCount of 0 means there is no upper limit
+  uint32_t imageCount = std::max(requestedImageCount, surfaceCapabilities.minImageCount);
+  if (surfaceCapabilities.maxImageCount != 0)
+    imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+
   VkSwapchainKHR swapChain;
   VkSwapchainCreateInfoKHR swapCreate{};
   swapCreate.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
   swapCreate.surface = surface;
-  swapCreate.minImageCount = surfaceCapabilities.minImageCount;
+  swapCreate.minImageCount = imageCount;
   swapCreate.imageFormat = surfaceFormat.format;
   swapCreate.imageColorSpace = surfaceFormat.colorSpace;
-  swapCreate.imageExtent = surfaceCapabilities.maxImageExtent;
+  swapCreate.imageExtent = renderExtent;
   swapCreate.imageArrayLayers = 1;
   swapCreate.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
   swapCreate.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
@@ -366,11 +673,14 @@ void VulkanInterface::CreateSwapChain(void)
 
   swapCreate.queueFamilyIndexCount = 1;
   swapCreate.pQueueFamilyIndices = indicies.data();
-  swapCreate.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  swapCreate.presentMode = presentMode;
   swapCreate.clipped = VK_TRUE;
   swapCreate.preTransform = surfaceCapabilities.currentTransform;
   swapCreate.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-  vkCreateSwapchainKHR(globalDevice, &swapCreate, nullptr, &swapChain);
+  // Lets the driver hand the old swapchain's resources over, frames using it keep going
+  swapCreate.oldSwapchain = _swapChain;
+  if (vkCreateSwapchainKHR(globalDevice, &swapCreate, nullptr, &swapChain) != VK_SUCCESS)
+    throw std::runtime_error("failed to create swapchain!");
 
   _swapChain = swapChain;
 
@@ -382,8 +692,195 @@ void VulkanInterface::CreateSwapChain(void)
   {
     _imageLayouts[i] = VK_IMAGE_LAYOUT_UNDEFINED;
   }
+  _imageValues = std::vector<uint64_t>(swapImageCount, 0);
   vkGetSwapchainImagesKHR(globalDevice, _swapChain, &swapImageCount, _swapImages.data());
 
+  VkSemaphoreCreateInfo semaCreate{};
+  semaCreate.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  _presentSemaphores = std::vector<VkSemaphore>(swapImageCount);
+  for (VkSemaphore& semaphore : _presentSemaphores)
+  {
+    if (vkCreateSemaphore(globalDevice, &semaCreate, nullptr, &semaphore) != VK_SUCCESS)
+      throw std::runtime_error("failed to create present semaphore!");
+  }
+
+}
+
+VkExtent2D VulkanInterface::SelectExtent(void)
+{
+  // The surface normally dictates the size, 0xFFFFFFFF leaves it to the swapchain
+  if (surfaceCapabilities.currentExtent.width != UINT32_MAX)
+    return surfaceCapabilities.currentExtent;
+
+  int width = 0;
+  int height = 0;
+  SDL_Vulkan_GetDrawableSize(globalWindow, &width, &height);
+  VkExtent2D extent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
+  extent.width = std::clamp(extent.width, surfaceCapabilities.minImageExtent.width, surfaceCapabilities.maxImageExtent.width);
+  extent.height = std::clamp(extent.height, surfaceCapabilities.minImageExtent.height, surfaceCapabilities.maxImageExtent.height);
+  return extent;
+}
+
+VkPresentModeKHR VulkanInterface::SelectPresentMode(void)
+{
+  uint32_t count = 0;
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &count, nullptr);
+  std::vector<VkPresentModeKHR> modes(count);
+  vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface, &count, modes.data());
+  // FIFO is the only mode every implementation has to support
+  if (std::find(modes.begin(), modes.end(), requestedPresentMode) != modes.end())
+    return requestedPresentMode;
+  return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+void VulkanInterface::SetPresentMode(VkPresentModeKHR mode)
+{
+  requestedPresentMode = mode;
+  if (globalDevice && headless == false)
+    swapchainDirty = true;
+}
+
+void VulkanInterface::SetSwapImageCount(uint32_t count)
+{
+  requestedImageCount = count;
+  if (globalDevice && headless == false)
+    swapchainDirty = true;
+}
+
+bool VulkanInterface::RecreateSwapChain(void)
+{
+  // A minimized window has nothing to render to. Wait for it without taking
+  // the application's events, unless it is about to quit
+  vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+  while (surfaceCapabilities.currentExtent.width == 0 || surfaceCapabilities.currentExtent.height == 0)
+  {
+    if (SDL_HasEvent(SDL_QUIT))
+      return false;
+    SDL_Delay(10);
+    SDL_PumpEvents();
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &surfaceCapabilities);
+  }
+
+  // Frames still in flight keep using the old resources, nothing waits for the device
+  retiredSwapchain retired{};
+  retired.swapchain = _swapChain;
+  retired.views.swap(_swapImageViews);
+  retired.framebuffers.swap(_buffers);
+  retired.depthImage = depthImage;
+  retired.depthMemory = depthMemory;
+  retired.depthView = depthView;
+  retired.presentSemaphores.swap(_presentSemaphores);
+  retired.retiredValue = graphicsTimeline.Submitted();
+  retiredSwapchains.push_back(std::move(retired));
+
+  CreateSwapChain();
+  CreateImageView();
+  CreateDepthTarget();
+  CreateFrameBuffer();
+  swapchainDirty = false;
+  return true;
+}
+
+void VulkanInterface::DestroyRetiredSwapchains(bool all)
+{
+  auto done = std::remove_if(retiredSwapchains.begin(), retiredSwapchains.end(), [&](retiredSwapchain& retired)
+    {
+      if (all == false && graphicsTimeline.IsComplete(retired.retiredValue) == false)
+        return false;
+      for (VkFramebuffer framebuffer : retired.framebuffers)
+        vkDestroyFramebuffer(globalDevice, framebuffer, nullptr);
+      for (VkImageView view : retired.views)
+        vkDestroyImageView(globalDevice, view, nullptr);
+      vkDestroyImageView(globalDevice, retired.depthView, nullptr);
+      vmaDestroyImage(allocator, retired.depthImage, retired.depthMemory);
+      for (VkSemaphore semaphore : retired.presentSemaphores)
+        vkDestroySemaphore(globalDevice, semaphore, nullptr);
+      vkDestroySwapchainKHR(globalDevice, retired.swapchain, nullptr);
+      return true;
+    });
+  retiredSwapchains.erase(done, retiredSwapchains.end());
+}
+
+void VulkanInterface::CreateOffscreenTargets(void)
+{
+  // Required color attachment format, so every implementation including lavapipe has it
+  surfaceFormat = { VK_FORMAT_R8G8B8A8_SRGB, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+
+  // One target per frame in flight stands in for the swap images
+  swapImageCount = framesInFlight;
+  _swapImages = std::vector<VkImage>(swapImageCount);
+  _offscreenMemory = std::vector<VmaAllocation>(swapImageCount);
+  _imageLayouts = std::vector<VkImageLayout>(swapImageCount, VK_IMAGE_LAYOUT_UNDEFINED);
+  _imageValues = std::vector<uint64_t>(swapImageCount, 0);
+
+  VkImageCreateInfo imageCreate{};
+  imageCreate.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageCreate.imageType = VK_IMAGE_TYPE_2D;
+  imageCreate.format = surfaceFormat.format;
+  imageCreate.extent = { renderExtent.width, renderExtent.height, 1 };
+  imageCreate.mipLevels = 1;
+  imageCreate.arrayLayers = 1;
+  imageCreate.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageCreate.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageCreate.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  imageCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageCreate.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+  for (uint32_t i = 0; i < swapImageCount; ++i)
+  {
+    if (vmaCreateImage(allocator, &imageCreate, &allocationInfo, &_swapImages[i], &_offscreenMemory[i], nullptr) != VK_SUCCESS)
+      throw std::runtime_error("failed to create offscreen render target!");
+  }
+}
+
+void VulkanInterface::ReadPixels(std::vector<uint8_t>& pixels)
+{
+  if (headless == false)
+    throw std::runtime_error("ReadPixels is only available in headless mode");
+  if (_isRendering)
+    throw std::runtime_error("Cannot read pixels while a render pass is recording");
+  if (_frame == 0)
+    throw std::runtime_error("Nothing has been rendered yet");
+
+  // The last submitted frame rendered into the target of the previous slot
+  uint32_t image = (currentFrame + framesInFlight - 1) % framesInFlight;
+  VkDeviceSize size = VkDeviceSize(renderExtent.width) * renderExtent.height * 4;
+  void* mapped = nullptr;
+  bufferInfo readback = CreateReadbackBuffer(size, &mapped);
+
+  VkBufferImageCopy region{};
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = { renderExtent.width, renderExtent.height, 1 };
+
+  /*
+   * EndSingleBuffer waits for its timeline value, which the queue reaches after the frame's own submission.
+   * That orders execution only, the barrier makes the pass's color writes visible to the copy.
+   * The pass already left the image in TRANSFER_SRC_OPTIMAL, so there is no layout change.
+   */
+  VkCommandBuffer commandBuffer = CreateSingleBuffer();
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.image = _swapImages[image];
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.layerCount = 1;
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+  vkCmdCopyImageToBuffer(commandBuffer, _swapImages[image], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readback.buffer, 1, &region);
+  EndSingleBuffer(commandBuffer);
+
+  vmaInvalidateAllocation(allocator, readback.memory, 0, size);
+  pixels.resize(static_cast<size_t>(size));
+  memcpy(pixels.data(), mapped, pixels.size());
+  ReleaseVertexBuffer(readback);
 }
 
 void VulkanInterface::CreateFrameBuffer(void)
@@ -393,16 +890,17 @@ void VulkanInterface::CreateFrameBuffer(void)
   for (int i = 0; i < size; ++i)
   {
     VkImageView attachments[] = {
-    _swapImageViews[i]
+    _swapImageViews[i],
+    depthView
     };
     VkFramebuffer buf;
     VkFramebufferCreateInfo frameBufferCreateInfo = {};
     frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     frameBufferCreateInfo.renderPass = currentRenderPass;
-    frameBufferCreateInfo.attachmentCount = 1;
+    frameBufferCreateInfo.attachmentCount = 2;
     frameBufferCreateInfo.pAttachments = attachments;
-    frameBufferCreateInfo.width = surfaceCapabilities.maxImageExtent.width;
-    frameBufferCreateInfo.height = surfaceCapabilities.maxImageExtent.height;
+    frameBufferCreateInfo.width = renderExtent.width;
+    frameBufferCreateInfo.height = renderExtent.height;
     frameBufferCreateInfo.layers = 1;
     vkCreateFramebuffer(globalDevice, &frameBufferCreateInfo, nullptr, &buf);
     _buffers.push_back(buf);
@@ -417,7 +915,7 @@ VkImage VulkanInterface::CreateImage(void)
   imageInfoCreate.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
   imageInfoCreate.imageType = VK_IMAGE_TYPE_2D;
   imageInfoCreate.format = surfaceFormat.format;
-  imageInfoCreate.extent = { surfaceCapabilities.maxImageExtent.width, surfaceCapabilities.maxImageExtent.height, 1 };
+  imageInfoCreate.extent = { renderExtent.width, renderExtent.height, 1 };
   imageInfoCreate.queueFamilyIndexCount = 1;
   imageInfoCreate.pQueueFamilyIndices = &queueFamilyInex;
   imageInfoCreate.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -491,45 +989,533 @@ void VulkanInterface::CreateCommandPool(void)
     VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
     0,
     VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-    (queueCount != 0) ? uint32_t(1) : 0 // Graphics
+    GraphicsFamily()
   };
 
-  if (vkCreateCommandPool(globalDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
-    throw std::runtime_error("failed to create command pool!");
-  }
+  if (vkCreateCommandPool(globalDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create command pool!");
+  }
+}
+
+void VulkanInterface::CreateCommandBuffer(void)
+{
+  std::array<VkCommandBuffer, MaxFramesInFlight * 2> CommandBuffers{};
+
+  if (pool == VK_NULL_HANDLE)
+    CreateCommandPool();
+
+  VkCommandBufferAllocateInfo allocInfo{};
+  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+  allocInfo.commandPool = pool;
+  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+  allocInfo.commandBufferCount = framesInFlight * 2;
+
+  if (vkAllocateCommandBuffers(globalDevice, &allocInfo, CommandBuffers.data()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate command buffers!");
+  }
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    vkResetCommandBuffer(CommandBuffers[i], 0);
+    frames[i].commandBuffer = CommandBuffers[i];
+    frames[i].acquireBuffer = CommandBuffers[framesInFlight + i];
+  }
+
+  primaryBuffer = frames[0].commandBuffer;
+}
+
+void VulkanInterface::SetTransientRingSize(VkDeviceSize bytesPerFrame)
+{
+  if (globalDevice)
+    throw std::runtime_error("Transient ring size must be set before Initialize");
+  transientRingSize = bytesPerFrame;
+}
+
+// Transient vertex and index data share the ring, and its overflow buffers
+static constexpr VkBufferUsageFlags TransientUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+void VulkanInterface::CreateTransientRing(void)
+{
+  transientRing.Create(allocator, transientRingSize, framesInFlight, TransientUsage);
+}
+
+ringAllocation VulkanInterface::AllocateTransient(VkDeviceSize size, VkDeviceSize alignment)
+{
+  ringAllocation alloc{};
+  if (transientRing.Allocate(size, alignment, &alloc))
+    return alloc;
+
+  // Ring is full for this frame, fall back to a dedicated buffer released with the frame
+  bufferInfo buffer = CreateTransientBuffer(size, alignment);
+  VmaAllocationInfo info;
+  vmaGetAllocationInfo(allocator, buffer.memory, &info);
+  alloc.buffer = buffer.buffer;
+  alloc.offset = 0;
+  alloc.data = info.pMappedData;
+  return alloc;
+}
+
+bufferInfo VulkanInterface::CreateTransientBuffer(VkDeviceSize size, VkDeviceSize alignment)
+{
+  VkBufferCreateInfo bufferCreate{};
+  bufferCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCreate.size = size;
+  bufferCreate.usage = TransientUsage;
+  bufferCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  // Coherent, nothing flushes this buffer the way the ring is flushed at the end of the frame
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO;
+  allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  bufferInfo buffer{};
+  buffer.size = size;
+  if (vmaCreateBufferWithAlignment(allocator, &bufferCreate, &allocationInfo, alignment, &buffer.buffer, &buffer.memory, nullptr) != VK_SUCCESS)
+    throw std::runtime_error("failed to create transient overflow buffer!");
+  frames[currentFrame].activeBuffers.push_back(buffer);
+  return buffer;
+}
+
+bufferInfo VulkanInterface::CreateHostBuffer(VkDeviceSize size, VkBufferUsageFlags usage, void** mapped)
+{
+  VkBufferCreateInfo bufferCreate{};
+  bufferCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCreate.size = size;
+  bufferCreate.usage = usage;
+  bufferCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO;
+  allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+  allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  bufferInfo result{};
+  result.size = size;
+  VmaAllocationInfo AllocInfo;
+  if (vmaCreateBuffer(allocator, &bufferCreate, &allocationInfo, &result.buffer, &result.memory, &AllocInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to create host visible buffer!");
+  *mapped = AllocInfo.pMappedData;
+  return result;
+}
+
+bufferInfo VulkanInterface::CreateReadbackBuffer(VkDeviceSize size, void** mapped)
+{
+  VkBufferCreateInfo bufferCreate{};
+  bufferCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCreate.size = size;
+  bufferCreate.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  // Read by the CPU, write combined memory would make every read uncached
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO;
+  allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+  allocationInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+  allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  bufferInfo result{};
+  result.size = size;
+  VmaAllocationInfo AllocInfo;
+  if (vmaCreateBuffer(allocator, &bufferCreate, &allocationInfo, &result.buffer, &result.memory, &AllocInfo) != VK_SUCCESS)
+    throw std::runtime_error("failed to create readback buffer!");
+  *mapped = AllocInfo.pMappedData;
+  return result;
+}
+
+void VulkanInterface::CreateFrameDescriptors(void)
+{
+  CreateDescriptorPool(&descriptorSetLayout);
+
+  std::array<VkDescriptorSetLayout, MaxFramesInFlight> layouts;
+  layouts.fill(descriptorSetLayout);
+  std::array<VkDescriptorSet, MaxFramesInFlight> sets{};
+
+  VkDescriptorSetAllocateInfo setAllocate{};
+  setAllocate.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  setAllocate.descriptorPool = descriptorPool;
+  setAllocate.descriptorSetCount = framesInFlight;
+  setAllocate.pSetLayouts = layouts.data();
+  if (vkAllocateDescriptorSets(globalDevice, &setAllocate, sets.data()) != VK_SUCCESS)
+    throw std::runtime_error("failed to allocate frame descriptor sets!");
+
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    frameData& frame = frames[i];
+    frame.descriptorSet = sets[i];
+
+    // The uniform buffer never changes size, so its descriptor is written once
+    frame.uniforms = CreateHostBuffer(sizeof(uniformBuffer) + sizeof(lightInfo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, &frame.uniformData);
+    VkDescriptorBufferInfo uniformInfo{};
+    uniformInfo.buffer = frame.uniforms.buffer;
+    uniformInfo.offset = 0;
+    uniformInfo.range = VK_WHOLE_SIZE;
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = frame.descriptorSet;
+    write.dstBinding = 1;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    write.pBufferInfo = &uniformInfo;
+    vkUpdateDescriptorSets(globalDevice, 1, &write, 0, nullptr);
+  }
+}
+
+void VulkanInterface::SetBlending(bool blended)
+{
+  activeBlend = blended;
+  if (_isRendering && IsQueueing() == false)
+    BindPipeline();
+}
+
+void VulkanInterface::QueueDraw(queuedDraw draw)
+{
+  draw.topology = currentTopology;
+  draw.blended = activeBlend;
+  draw.material = activeMaterial;
+  if (instanceObjectBase != UINT32_MAX)
+  {
+    draw.firstObject = instanceObjectBase;
+  }
+  else
+  {
+    draw.firstObject = static_cast<uint32_t>(queuedObjects.size());
+    for (uint32_t i = 0; i < draw.instanceCount; ++i)
+      queuedObjects.push_back(drawConstant);
+  }
+  drawQueue.push_back(draw);
+}
+
+static uint64_t HandleBits(VkBuffer buffer)
+{
+  uint64_t bits = 0;
+  memcpy(&bits, &buffer, sizeof(buffer));
+  return bits;
+}
+
+uint64_t VulkanInterface::BuildSortKey(queuedDraw const& draw, uint32_t meshId, glm::mat4x4 const& viewProjection)
+{
+  // View depth of the object's origin, quantized over the projection's depth range
+  glm::vec4 clip = viewProjection * queuedObjects[draw.firstObject].model[3];
+  float depth = glm::clamp((clip.w - activeCamera.nearPlane) / (activeCamera.farPlane - activeCamera.nearPlane), 0.0f, 1.0f);
+  uint64_t depthBucket = static_cast<uint64_t>(depth * 65535.0f);
+  uint64_t topo = static_cast<uint64_t>(getTopologyClass(draw.topology)) & 0x3;
+  uint64_t mesh = meshId & 0x1FFFFFFF;
+
+  if (draw.blended == false)
+  {
+    // 0 | topology 2 | material 16 | depth 16 (front to back) | mesh 29
+    return (topo << 61) | (uint64_t(draw.material) << 45) | (depthBucket << 29) | mesh;
+  }
+  // 1 | depth 16 (back to front) | topology 2 | material 16 | mesh 29
+  return (uint64_t(1) << 63) | ((0xFFFF - depthBucket) << 47) | (topo << 45) | (uint64_t(draw.material) << 29) | mesh;
+}
+
+void VulkanInterface::FlushDrawQueue(void)
+{
+  if (drawQueue.empty())
+  {
+    // The color subpass still has to be reached before the render pass can end
+    if (depthPrePass)
+      vkCmdNextSubpass(primaryBuffer, (recordingThreads > 1) ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+    return;
+  }
+  frameData& frame = frames[currentFrame];
+
+  // Grow the frame's buffers if needed, this slot's last frame has already retired
+  VkDeviceSize objectBytes = sizeof(objectTransform) * queuedObjects.size();
+  if (frame.objectBuffer.size < objectBytes)
+  {
+    if (frame.objectBuffer.buffer)
+      ReleaseVertexBuffer(frame.objectBuffer);
+    frame.objectBuffer = CreateHostBuffer(objectBytes * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &frame.objectData);
+
+    VkDescriptorBufferInfo objectInfo{};
+    objectInfo.buffer = frame.objectBuffer.buffer;
+    objectInfo.offset = 0;
+    objectInfo.range = VK_WHOLE_SIZE;
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = frame.descriptorSet;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &objectInfo;
+    vkUpdateDescriptorSets(globalDevice, 1, &write, 0, nullptr);
+  }
+  memcpy(frame.objectData, queuedObjects.data(), objectBytes);
+  vmaFlushAllocation(allocator, frame.objectBuffer.memory, 0, objectBytes);
+
+  // The final camera for the frame, the keys are built against the same matrices
+  UpdateCameraMatrices();
+  glm::mat4x4 const& viewProjection = constantBuffer.combinedProjection;
+
+  // Mesh ids in order of first use, identical geometry sorts next to each other
+  std::unordered_map<uint64_t, uint32_t> meshIds;
+  sortEntries.resize(drawQueue.size());
+  for (size_t i = 0; i < drawQueue.size(); ++i)
+  {
+    queuedDraw const& draw = drawQueue[i];
+    uint64_t geometry = HandleBits(draw.vertices.buffer) ^ (HandleBits(draw.indexBuffer) * 31) ^ (draw.vertices.offsets[PositionStream] * 131);
+    uint32_t meshId = meshIds.emplace(geometry, static_cast<uint32_t>(meshIds.size())).first->second;
+    sortEntries[i].key = BuildSortKey(draw, meshId, viewProjection);
+    sortEntries[i].index = static_cast<uint32_t>(i);
+  }
+  RadixSort(sortEntries, sortScratch);
+
+  sortedDraws.resize(drawQueue.size());
+  for (size_t i = 0; i < sortEntries.size(); ++i)
+    sortedDraws[i] = drawQueue[sortEntries[i].index];
+
+  // Indexed and plain commands share one buffer at the larger stride
+  const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  VkDeviceSize commandBytes = stride * sortedDraws.size();
+  if (UseIndirectCommands())
+  {
+    if (frame.indirectBuffer.size < commandBytes)
+    {
+      if (frame.indirectBuffer.buffer)
+        ReleaseVertexBuffer(frame.indirectBuffer);
+      frame.indirectBuffer = CreateHostBuffer(commandBytes * 2, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, &frame.indirectData);
+    }
+
+    char* commands = static_cast<char*>(frame.indirectData);
+    for (size_t i = 0; i < sortedDraws.size(); ++i)
+    {
+      queuedDraw const& draw = sortedDraws[i];
+      if (draw.indexBuffer)
+      {
+        VkDrawIndexedIndirectCommand command{ draw.count, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstObject };
+        memcpy(commands + stride * i, &command, sizeof(command));
+      }
+      else
+      {
+        VkDrawIndirectCommand command{ draw.count, draw.instanceCount, static_cast<uint32_t>(draw.vertexOffset), draw.firstObject };
+        memcpy(commands + stride * i, &command, sizeof(command));
+      }
+    }
+    vmaFlushAllocation(allocator, frame.indirectBuffer.memory, 0, commandBytes);
+  }
+
+  // Recording reads the handles directly, wait here for any still compiling
+  for (int blend = 0; blend < BlendModeCount; ++blend)
+  {
+    for (int topo = 0; topo < 3; ++topo)
+    {
+      GetPipeline(IndirectPipeline, blend != 0, static_cast<TopoClass>(topo));
+      if (depthPrePass && blend == 0)
+        GetPipeline(DepthPipeline, false, static_cast<TopoClass>(topo));
+    }
+  }
+
+  if (depthPrePass)
+  {
+    // Opaque draws sort ahead of blended ones and are the only ones laying down depth
+    size_t opaqueCount = 0;
+    while (opaqueCount < sortedDraws.size() && sortedDraws[opaqueCount].blended == false)
+      ++opaqueCount;
+    RecordQueue(opaqueCount, true);
+    vkCmdNextSubpass(primaryBuffer, (recordingThreads > 1) ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+  }
+  RecordQueue(sortedDraws.size(), false);
+
+  drawQueue.clear();
+  queuedObjects.clear();
+}
+
+void VulkanInterface::RecordQueue(size_t count, bool depthOnly)
+{
+  if (count == 0)
+    return;
+  frameData& frame = frames[currentFrame];
+  if (recordingThreads > 1)
+  {
+    // Contiguous slices of the sorted queue, each recorded by its own thread into
+    // a secondary buffer from that slot's pool. The depth pass uses the second set
+    VkCommandBuffer* buffers = frame.recordBuffers.data() + (depthOnly ? recordingThreads : 0);
+    uint32_t slices = static_cast<uint32_t>(std::min<size_t>(recordingThreads, (count + MinDrawsPerSlice - 1) / MinDrawsPerSlice));
+    size_t sliceSize = (count + slices - 1) / slices;
+    recordPool.Dispatch(slices, [&](uint32_t slice)
+      {
+        size_t begin = sliceSize * slice;
+        size_t end = std::min<size_t>(begin + sliceSize, count);
+        RecordSecondary(buffers[slice], begin, end, depthOnly);
+      });
+    vkCmdExecuteCommands(primaryBuffer, slices, buffers);
+  }
+  else
+  {
+    RecordDrawRange(primaryBuffer, 0, count, depthOnly);
+    boundPipeline = VK_NULL_HANDLE;
+  }
+}
+
+void VulkanInterface::RecordSecondary(VkCommandBuffer buffer, size_t begin, size_t end, bool depthOnly)
+{
+  ProfileScope record(PhaseRecord);
+  VkCommandBufferInheritanceInfo inheritance{};
+  inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritance.renderPass = currentRenderPass;
+  inheritance.subpass = depthOnly ? 0 : ColorSubpass();
+  inheritance.framebuffer = _buffers[imageIndex];
+
+  VkCommandBufferBeginInfo beginInfo{};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  beginInfo.pInheritanceInfo = &inheritance;
+  vkBeginCommandBuffer(buffer, &beginInfo);
+
+  // Nothing is inherited from the primary buffer besides the render pass
+  SetViewportState(buffer);
+  RecordDrawRange(buffer, begin, end, depthOnly);
+  vkEndCommandBuffer(buffer);
+}
+
+void VulkanInterface::RecordDrawRange(VkCommandBuffer buffer, size_t begin, size_t end, bool depthOnly)
+{
+  // Called from recording threads, only reads the flushed queue and the frame's buffers
+  frameData const& frame = frames[currentFrame];
+  const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+  VkPipeline bound = VK_NULL_HANDLE;
+  vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+
+  // Consecutive draws sharing state form a group, state is only set once per group
+  size_t groupStart = begin;
+  while (groupStart < end)
+  {
+    queuedDraw const& first = sortedDraws[groupStart];
+    size_t groupEnd = groupStart + 1;
+    while (groupEnd < end
+      && sortedDraws[groupEnd].topology == first.topology
+      && sortedDraws[groupEnd].blended == first.blended
+      && sortedDraws[groupEnd].vertices.buffer == first.vertices.buffer
+      && sortedDraws[groupEnd].vertices.offsets == first.vertices.offsets
+      && sortedDraws[groupEnd].indexBuffer == first.indexBuffer
+      && sortedDraws[groupEnd].indexType == first.indexType)
+      ++groupEnd;
+
+    VkPipeline pipeline = depthOnly
+      ? ActivePipelines[DepthPipeline][0][getTopologyClass(first.topology)]
+      : ActivePipelines[IndirectPipeline][first.blended ? 1 : 0][getTopologyClass(first.topology)];
+    if (pipeline != bound)
+    {
+      vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+      bound = pipeline;
+    }
+    vkCmdSetPrimitiveTopology(buffer, first.topology);
+    BindVertexStreams(buffer, first.vertices, depthOnly);
+    if (first.indexBuffer)
+      vkCmdBindIndexBuffer(buffer, first.indexBuffer, 0, first.indexType);
+
+    if (UseIndirectCommands())
+    {
+      // Without multiDrawIndirect every call is limited to a single draw
+      for (size_t call = groupStart; call < groupEnd; call += maxDrawIndirectCount)
+      {
+        uint32_t drawCount = static_cast<uint32_t>(std::min<size_t>(groupEnd - call, maxDrawIndirectCount));
+        if (first.indexBuffer)
+          vkCmdDrawIndexedIndirect(buffer, frame.indirectBuffer.buffer, stride * call, drawCount, stride);
+        else
+          vkCmdDrawIndirect(buffer, frame.indirectBuffer.buffer, stride * call, drawCount, stride);
+      }
+    }
+    else
+    {
+      for (size_t i = groupStart; i < groupEnd; ++i)
+      {
+        queuedDraw const& draw = sortedDraws[i];
+        if (draw.indexBuffer)
+          vkCmdDrawIndexed(buffer, draw.count, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstObject);
+        else
+          vkCmdDraw(buffer, draw.count, draw.instanceCount, static_cast<uint32_t>(draw.vertexOffset), draw.firstObject);
+      }
+    }
+    groupStart = groupEnd;
+  }
+}
+
+void VulkanInterface::BeginGpuScope(char const* label)
+{
+  if (!_isRendering)
+    throw std::runtime_error("GPU scopes must be opened inside a render pass");
+  // The subpass only executes secondary buffers, nothing can be timed inside it
+  if (recordingThreads > 1)
+    return;
+  gpuTimer.BeginScope(primaryBuffer, label);
+}
+
+void VulkanInterface::EndGpuScope(void)
+{
+  if (!_isRendering || recordingThreads > 1)
+    return;
+  gpuTimer.EndScope(primaryBuffer);
 }
 
-void VulkanInterface::CreateCommandBuffer(void)
+void VulkanInterface::SetRecordingThreads(uint32_t count)
 {
-  VkCommandBuffer CommandBuffer;
+  if (globalDevice)
+    throw std::runtime_error("Recording threads must be set before Initialize");
+  if (count < 1)
+    count = 1;
+  recordingThreads = count;
+}
 
-  if (pool == VK_NULL_HANDLE)
-    CreateCommandPool();
+void VulkanInterface::CreateRecordingPools(void)
+{
+  if (recordingThreads < 2)
+    return;
+  recordPool.Create(recordingThreads);
 
-  VkCommandBufferAllocateInfo allocInfo{};
-  allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-  allocInfo.commandPool = pool;
-  allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-  allocInfo.commandBufferCount = 1;
+  // Command pools are externally synchronized, so every slice of every frame gets its own
+  VkCommandPoolCreateInfo poolInfo{};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+  poolInfo.queueFamilyIndex = GraphicsFamily();
 
-  if (vkAllocateCommandBuffers(globalDevice, &allocInfo, &CommandBuffer) != VK_SUCCESS) {
-    throw std::runtime_error("failed to allocate command buffers!");
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    frameData& frame = frames[i];
+    // With the pre-pass every pool also holds the thread's depth pass buffer
+    frame.recordPools.resize(recordingThreads);
+    frame.recordBuffers.resize(depthPrePass ? recordingThreads * 2 : recordingThreads);
+    for (uint32_t t = 0; t < recordingThreads; ++t)
+    {
+      if (vkCreateCommandPool(globalDevice, &poolInfo, nullptr, &frame.recordPools[t]) != VK_SUCCESS)
+        throw std::runtime_error("failed to create recording command pool!");
+
+      VkCommandBufferAllocateInfo allocInfo{};
+      allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      allocInfo.commandPool = frame.recordPools[t];
+      allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      allocInfo.commandBufferCount = depthPrePass ? 2 : 1;
+      std::array<VkCommandBuffer, 2> buffers{};
+      if (vkAllocateCommandBuffers(globalDevice, &allocInfo, buffers.data()) != VK_SUCCESS)
+        throw std::runtime_error("failed to allocate secondary command buffers!");
+      frame.recordBuffers[t] = buffers[0];
+      if (depthPrePass)
+        frame.recordBuffers[recordingThreads + t] = buffers[1];
+    }
   }
-  vkResetCommandBuffer(CommandBuffer, 0);
+}
+
+void VulkanInterface::CreateSyncObjects(void)
+{
+  // Frame slots are tracked on the graphics timeline, only acquiring needs binary semaphores.
+  // Present semaphores belong to the swap images and are created with the swapchain
+  VkSemaphoreCreateInfo semaCreate{};
+  semaCreate.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-  primaryBuffer = CommandBuffer;
+  for (uint32_t i = 0; i < framesInFlight; ++i)
+  {
+    frames[i].timelineValue = 0;
+    if (vkCreateSemaphore(globalDevice, &semaCreate, nullptr, &frames[i].imageGet) != VK_SUCCESS)
+      throw std::runtime_error("failed to create frame synchronization objects!");
+  }
 }
 
 VkShaderModule VulkanInterface::CreateShader(std::string path)
 {
-  VkShaderModule shaderModule;
-  VkShaderModuleCreateInfo shaderCreate{};
-  std::vector<char> shaderCode = readShaderFile(path);
-  shaderCreate.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
-  shaderCreate.codeSize = shaderCode.size();
-  shaderCreate.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  vkCreateShaderModule(globalDevice, &shaderCreate, nullptr, &shaderModule);
-  return shaderModule;
+  // Owned by the registry and shared with every other pipeline using the same code
+  return shaderRegistry.Get(path);
 }
 
 VkPipelineShaderStageCreateInfo VulkanInterface::CreateShaderInfo(std::string path, VkShaderStageFlagBits stage)
@@ -555,10 +1541,10 @@ VkPipelineInputAssemblyStateCreateInfo VulkanInterface::CreateInputAssemblyState
 VkPipelineViewportStateCreateInfo VulkanInterface::CreateViewPortState(void)
 {
   static VkViewport port{ 0,0,
-    static_cast<float>(surfaceCapabilities.maxImageExtent.width),
-    static_cast<float>(surfaceCapabilities.maxImageExtent.height), 0, 1 };
+    static_cast<float>(renderExtent.width),
+    static_cast<float>(renderExtent.height), 0, 1 };
   static VkRect2D scissor{ {0,0},
-    surfaceCapabilities.maxImageExtent };
+    renderExtent };
   VkPipelineViewportStateCreateInfo viewPortState{};
   viewPortState.viewportCount = 1;
   viewPortState.pViewports = &port;
@@ -599,15 +1585,28 @@ VkPipelineMultisampleStateCreateInfo VulkanInterface::CreateMultiSampleInfo(void
   return multiStateCreate;
 }
 
-VkPipelineColorBlendStateCreateInfo VulkanInterface::CreateColorBlendState(void)
+VkPipelineColorBlendStateCreateInfo VulkanInterface::CreateColorBlendState(bool blended)
 {
-  static std::array<VkPipelineColorBlendAttachmentState, 2> colorBlend{};
-  colorBlend[0].blendEnable = VK_FALSE;
-  colorBlend[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT
-    | VK_COLOR_COMPONENT_G_BIT
-    | VK_COLOR_COMPONENT_B_BIT
-    | VK_COLOR_COMPONENT_A_BIT;
-  colorBlend[1] = colorBlend[0];
+  // Built once, pipelines are compiled from several threads at a time
+  static const std::array<VkPipelineColorBlendAttachmentState, 2> colorBlend = []()
+    {
+      std::array<VkPipelineColorBlendAttachmentState, 2> states{};
+      states[0].blendEnable = VK_FALSE;
+      states[0].colorWriteMask = VK_COLOR_COMPONENT_R_BIT
+        | VK_COLOR_COMPONENT_G_BIT
+        | VK_COLOR_COMPONENT_B_BIT
+        | VK_COLOR_COMPONENT_A_BIT;
+      states[1] = states[0];
+      // [1] is standard alpha blending
+      states[1].blendEnable = VK_TRUE;
+      states[1].srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+      states[1].dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+      states[1].colorBlendOp = VK_BLEND_OP_ADD;
+      states[1].srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+      states[1].dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+      states[1].alphaBlendOp = VK_BLEND_OP_ADD;
+      return states;
+    }();
 
   // THese two structures ^ v
   VkPipelineColorBlendStateCreateInfo colorBlendCreate{};
@@ -615,7 +1614,7 @@ VkPipelineColorBlendStateCreateInfo VulkanInterface::CreateColorBlendState(void)
   colorBlendCreate.logicOp = VK_LOGIC_OP_AND;
   colorBlendCreate.logicOpEnable = VK_FALSE;
   colorBlendCreate.attachmentCount = 1;
-  colorBlendCreate.pAttachments = colorBlend.data();
+  colorBlendCreate.pAttachments = &colorBlend[blended ? 1 : 0];
   colorBlendCreate.blendConstants[0] = 1;
   colorBlendCreate.blendConstants[1] = 1;
   colorBlendCreate.blendConstants[2] = 1;
@@ -626,11 +1625,17 @@ VkPipelineColorBlendStateCreateInfo VulkanInterface::CreateColorBlendState(void)
 
 VkDescriptorSetLayout VulkanInterface::CreateDescriptorSetLayout(void)
 {
-  std::array<VkDescriptorSetLayoutBinding, 1> layoutBindings = {};
+  // Binding 0 - per object model matrices for indirect draws
+  // Binding 1 - per frame camera and light
+  std::array<VkDescriptorSetLayoutBinding, 2> layoutBindings = {};
   layoutBindings[0].binding = uint32_t(0);
-  layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
-  layoutBindings[0].descriptorCount = 0;
-  layoutBindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+  layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  layoutBindings[0].descriptorCount = 1;
+  layoutBindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  layoutBindings[1].binding = uint32_t(1);
+  layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  layoutBindings[1].descriptorCount = 1;
+  layoutBindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
   VkDescriptorSetLayout setLayout;
   VkDescriptorSetLayoutCreateInfo SetCreate{};
@@ -640,41 +1645,44 @@ VkDescriptorSetLayout VulkanInterface::CreateDescriptorSetLayout(void)
 
 
   vkCreateDescriptorSetLayout(globalDevice, &SetCreate, nullptr, &setLayout);
+  descriptorSetLayout = setLayout;
   return setLayout;
 }
 
 VkDescriptorPool VulkanInterface::CreateDescriptorPool(VkDescriptorSetLayout* setLayout)
 {
-  VkDescriptorPoolSize psize{};
+  std::array<VkDescriptorPoolSize, 2> psize{};
 
-  psize.descriptorCount = 2;
-  psize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+  // One set per frame in flight
+  psize[0].descriptorCount = MaxFramesInFlight;
+  psize[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  psize[1].descriptorCount = MaxFramesInFlight;
+  psize[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
-  VkDescriptorPool descriptorPool;
+  VkDescriptorPool pool;
   VkDescriptorPoolCreateInfo descriPool{};
   descriPool.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-  descriPool.maxSets = 10;
-  descriPool.poolSizeCount = 1;
-  descriPool.pPoolSizes = &psize;
+  descriPool.maxSets = MaxFramesInFlight;
+  descriPool.poolSizeCount = static_cast<uint32_t>(psize.size());
+  descriPool.pPoolSizes = psize.data();
 
-  vkCreateDescriptorPool(globalDevice, &descriPool, nullptr, &descriptorPool);
-  return descriptorPool;
+  vkCreateDescriptorPool(globalDevice, &descriPool, nullptr, &pool);
+  descriptorPool = pool;
+  return pool;
 }
 
 VkPipelineLayout VulkanInterface::CreatePipelineLayout(VkDescriptorSetLayout* setLayout)
 {
-  std::array<VkPushConstantRange, 2> constantRanges{};
-  constantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-  constantRanges[0].size = sizeof(uniformBuffer);
+  // Everything else lives in the frame's uniform buffer
+  std::array<VkPushConstantRange, 1> constantRanges{};
+  constantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+  constantRanges[0].size = sizeof(objectTransform);
   constantRanges[0].offset = 0;
-  constantRanges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_VERTEX_BIT;
-  constantRanges[1].size = sizeof(lightInfo);
-  constantRanges[1].offset = sizeof(uniformBuffer);
 
   VkPipelineLayout layout;
   VkPipelineLayoutCreateInfo layoutCreate{};
   layoutCreate.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  layoutCreate.setLayoutCount = 0;
+  layoutCreate.setLayoutCount = 1;
   layoutCreate.pSetLayouts = setLayout;
   layoutCreate.pPushConstantRanges = constantRanges.data();
   layoutCreate.pushConstantRangeCount = constantRanges.size();
@@ -683,96 +1691,253 @@ VkPipelineLayout VulkanInterface::CreatePipelineLayout(VkDescriptorSetLayout* se
   return layout;
 }
 
-VkPipelineDepthStencilStateCreateInfo VulkanInterface::CreateDepthStencilStat(void)
+VkPipelineDepthStencilStateCreateInfo VulkanInterface::CreateDepthStencilStat(pipelineDesc const& desc, bool blended)
 {
   VkPipelineDepthStencilStateCreateInfo state{};
   state.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
   state.depthTestEnable = VK_TRUE;
   state.depthWriteEnable = VK_TRUE;
-  state.depthCompareOp = VK_COMPARE_OP_GREATER;
+  state.depthCompareOp = reverseZ ? VK_COMPARE_OP_GREATER : VK_COMPARE_OP_LESS;
+  // Blended geometry is tested against depth but doesn't occlude what is behind it
+  if (blended)
+    state.depthWriteEnable = VK_FALSE;
+  // After the pre-pass depth is final, opaque surfaces only shade where they won
+  if (depthPrePass && desc.depthOnly == false && blended == false)
+  {
+    state.depthWriteEnable = VK_FALSE;
+    state.depthCompareOp = VK_COMPARE_OP_EQUAL;
+  }
   //state.front            = state.back;
   state.back.compareOp = VK_COMPARE_OP_ALWAYS;
 
   return state;
 }
 
-void VulkanInterface::CreateGraphicsPipeline(void)
+pipelineDesc VulkanInterface::GetPipelineDesc(PipelineVariant variant)
+{
+  pipelineDesc desc{};
+  desc.fragmentShader = "./Shaders/frag.spv";
+  desc.subpass = ColorSubpass();
+  desc.depthOnly = false;
+  switch (variant)
+  {
+  case DepthPipeline:
+    desc.vertexShader = "./Shaders/vert_depth.spv";
+    desc.fragmentShader.clear();
+    desc.vertexInput = VertexStreams::GetInfo(PositionStreamMask);
+    desc.subpass = 0;
+    desc.depthOnly = true;
+    break;
+  case InstancedPipeline:
+    desc.vertexShader = "./Shaders/vert_instanced.spv";
+    desc.vertexInput = VertexStreams::GetInstancedInfo(AllStreamsMask);
+    break;
+  case IndirectPipeline:
+    desc.vertexShader = "./Shaders/vert_indirect.spv";
+    desc.vertexInput = VertexStreams::GetInfo(AllStreamsMask);
+    break;
+  case StandardPipeline:
+  default:
+    desc.vertexShader = "./Shaders/vert.spv";
+    desc.vertexInput = VertexStreams::GetInfo(AllStreamsMask);
+    break;
+  }
+  return desc;
+}
+
+VkPipeline VulkanInterface::CreatePipeline(pipelineDesc const& desc, std::span<const VkPipelineShaderStageCreateInfo> shaders, VkPrimitiveTopology topology, bool blended, VkPipeline parent)
 {
   VkPipeline pipeline = NULL;
 
-  VkPipelineShaderStageCreateInfo shaders[] =
-  {
-    CreateShaderInfo("./Shaders/frag.spv",VK_SHADER_STAGE_FRAGMENT_BIT),
-    CreateShaderInfo("./Shaders/vert.spv", VK_SHADER_STAGE_VERTEX_BIT)
-  };
   VkPipelineVertexInputStateCreateInfo vertexShader{}; // 3377
-  VertexInfo info = Vertex::GetInfo();
   vertexShader.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertexShader.pVertexAttributeDescriptions = info.attributes.data();
-  vertexShader.vertexAttributeDescriptionCount = static_cast<uint32_t>(info.attributes.size());;
-  vertexShader.vertexBindingDescriptionCount = uint32_t(info.bindings.size());
-  vertexShader.pVertexBindingDescriptions = info.bindings.data();
+  vertexShader.pVertexAttributeDescriptions = desc.vertexInput.attributes.data();
+  vertexShader.vertexAttributeDescriptionCount = static_cast<uint32_t>(desc.vertexInput.attributes.size());
+  vertexShader.vertexBindingDescriptionCount = uint32_t(desc.vertexInput.bindings.size());
+  vertexShader.pVertexBindingDescriptions = desc.vertexInput.bindings.data();
   VkPipelineInputAssemblyStateCreateInfo inputState = CreateInputAssemblyState();
+  inputState.topology = topology;
   VkPipelineViewportStateCreateInfo viewPortState = CreateViewPortState();
   VkPipelineRasterizationStateCreateInfo rasterizationCreate = CreateaRasterizationState();
   VkPipelineMultisampleStateCreateInfo multiStateCreate = CreateMultiSampleInfo();
-  VkPipelineColorBlendStateCreateInfo colorBlendCreate = CreateColorBlendState();
-  VkPipelineDepthStencilStateCreateInfo depthStencilCreate = CreateDepthStencilStat();
-  VkDynamicState states[] = { VK_DYNAMIC_STATE_VIEWPORT ,VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY };
+  VkPipelineColorBlendStateCreateInfo colorBlendCreate = CreateColorBlendState(blended);
+  if (desc.depthOnly)
+    colorBlendCreate.attachmentCount = 0;
+  VkPipelineDepthStencilStateCreateInfo depthStencilCreate = CreateDepthStencilStat(desc, blended);
+  // Dynamic strides let interleaved and separate vertex streams share pipelines
+  VkDynamicState states[] = { VK_DYNAMIC_STATE_VIEWPORT ,VK_DYNAMIC_STATE_SCISSOR, VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY, VK_DYNAMIC_STATE_VERTEX_INPUT_BINDING_STRIDE };
   VkPipelineDynamicStateCreateInfo dynamState{};
   dynamState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
   dynamState.pDynamicStates = states;
   dynamState.dynamicStateCount = _countof(states);
 
-
-  VkDescriptorSetLayout setLayout = CreateDescriptorSetLayout();
-
   VkGraphicsPipelineCreateInfo pipelineCreate{}; // 3504
   pipelineCreate.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineCreate.pStages = shaders;
-  pipelineCreate.stageCount = 2;
-  pipelineCreate.flags = VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+  pipelineCreate.pStages = shaders.data();
+  pipelineCreate.stageCount = static_cast<uint32_t>(shaders.size());
+  pipelineCreate.flags = (parent == VK_NULL_HANDLE) ? VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT : VK_PIPELINE_CREATE_DERIVATIVE_BIT;
   pipelineCreate.pVertexInputState = &vertexShader;
   pipelineCreate.pInputAssemblyState = &inputState;
   pipelineCreate.pViewportState = &viewPortState;
-  pipelineCreate.basePipelineHandle = VK_NULL_HANDLE;
+  pipelineCreate.basePipelineHandle = parent;
   pipelineCreate.basePipelineIndex = -1;
   pipelineCreate.renderPass = currentRenderPass;
-  pipelineCreate.subpass = 0;
+  pipelineCreate.subpass = desc.subpass;
   pipelineCreate.pRasterizationState = &rasterizationCreate;
   pipelineCreate.pColorBlendState = &colorBlendCreate;
   pipelineCreate.pMultisampleState = &multiStateCreate;
-  pipelineCreate.layout = CreatePipelineLayout(&setLayout);
+  pipelineCreate.layout = pipelayout;
   pipelineCreate.pDepthStencilState = &depthStencilCreate;
   pipelineCreate.pDynamicState = &dynamState;
 
-  vkCreateGraphicsPipelines(globalDevice, VK_NULL_HANDLE, 1, &pipelineCreate, nullptr, &pipeline);
-  ParentPipeline = pipeline;
+  if (vkCreateGraphicsPipelines(globalDevice, pipelineCache.Get(), 1, &pipelineCreate, nullptr, &pipeline) != VK_SUCCESS)
+    throw std::runtime_error("failed to create graphics pipeline!");
+  return pipeline;
+}
 
-  inputState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-  pipelineCreate.flags = VK_PIPELINE_CREATE_DERIVATIVE_BIT;
-  pipelineCreate.basePipelineHandle = ParentPipeline;
-  vkCreateGraphicsPipelines(globalDevice, VK_NULL_HANDLE, 1, &pipelineCreate, nullptr, &pipeline);
-  ActivePipelines[0] = pipeline;
+void VulkanInterface::CreateGraphicsPipeline(void)
+{
+  VkDescriptorSetLayout setLayout = CreateDescriptorSetLayout();
+  CreatePipelineLayout(&setLayout);
+
+  // Points still share the line pipeline, the shaders don't write gl_PointSize
+  const VkPrimitiveTopology classTopology[] = {
+    VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    VK_PRIMITIVE_TOPOLOGY_LINE_LIST,
+    VK_PRIMITIVE_TOPOLOGY_LINE_LIST
+  };
+
+  uint32_t threads = std::thread::hardware_concurrency();
+  buildPool.Create(threads > 0 ? threads : 1);
+  // The depth variant only exists with the pre-pass, and only opaque
+  pendingBuilds = (PipelineVariantCount - 1) * BlendModeCount * _countof(classTopology);
+  if (depthPrePass)
+    pendingBuilds += _countof(classTopology);
 
-  inputState.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
-  vkCreateGraphicsPipelines(globalDevice, VK_NULL_HANDLE, 1, &pipelineCreate, nullptr, &pipeline);
-  ActivePipelines[1] = pipeline;
+  for (int variant = 0; variant < PipelineVariantCount; ++variant)
+  {
+    if (variant == DepthPipeline && depthPrePass == false)
+      continue;
+    // Shared by every build of the variant
+    auto desc = std::make_shared<pipelineDesc>(GetPipelineDesc(static_cast<PipelineVariant>(variant)));
+    auto shaders = std::make_shared<std::vector<VkPipelineShaderStageCreateInfo>>();
+    if (desc->fragmentShader.empty() == false)
+      shaders->push_back(CreateShaderInfo(desc->fragmentShader, VK_SHADER_STAGE_FRAGMENT_BIT));
+    shaders->push_back(CreateShaderInfo(desc->vertexShader, VK_SHADER_STAGE_VERTEX_BIT));
+
+    // Every other pipeline derives from the first one built, so it can't wait
+    if (variant == StandardPipeline)
+      ParentPipeline = CreatePipeline(*desc, *shaders, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, false, VK_NULL_HANDLE);
+
+    for (int blend = 0; blend < BlendModeCount; ++blend)
+    {
+      if (desc->depthOnly && blend != 0)
+        break;
+      for (int topo = 0; topo < _countof(classTopology); ++topo)
+      {
+        ActivePipelines[variant][blend][topo] = VK_NULL_HANDLE;
+        VkPrimitiveTopology topology = classTopology[topo];
+        pipelineBuilds[variant][blend][topo] = buildPool.Async([this, desc, shaders, topology, blend]()
+          {
+            VkPipeline pipeline = VK_NULL_HANDLE;
+            try
+            {
+              pipeline = CreatePipeline(*desc, *shaders, topology, blend != 0, ParentPipeline);
+            }
+            catch (...)
+            {
+              FinishPipelineBuild();
+              throw;
+            }
+            FinishPipelineBuild();
+            return pipeline;
+          });
+      }
+    }
+  }
+}
+
+void VulkanInterface::FinishPipelineBuild(void)
+{
+  // Runs on a build thread, the last one to finish saves for all of them
+  if (--pendingBuilds != 0)
+    return;
+  // Keep whatever was compiled even if the program never shuts down cleanly
+  pipelineCache.Save();
+}
 
-  //inputState.topology = VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
-  vkCreateGraphicsPipelines(globalDevice, VK_NULL_HANDLE, 1, &pipelineCreate, nullptr, &pipeline);
-  ActivePipelines[2] = pipeline;
+VkPipeline VulkanInterface::GetPipeline(PipelineVariant variant, bool blended, TopoClass topology)
+{
+  VkPipeline& pipeline = ActivePipelines[variant][blended ? 1 : 0][topology];
+  // The first use waits for the build if it's still compiling
+  if (pipeline == VK_NULL_HANDLE)
+    pipeline = pipelineBuilds[variant][blended ? 1 : 0][topology].get();
+  return pipeline;
+}
+
+void VulkanInterface::BindPipeline(void)
+{
+  VkPipeline pipeline = GetPipeline(activeVariant, activeBlend, activeTopology);
+  if (pipeline != boundPipeline)
+  {
+    vkCmdBindPipeline(primaryBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    boundPipeline = pipeline;
+  }
 }
 
-void VulkanInterface::BeginRenderPass()
+bool VulkanInterface::BeginRenderPass()
 {
+  ProfileScope record(PhaseRecord);
+  frameData& frame = frames[currentFrame];
 
-  vkWaitForFences(globalDevice, 1, &fence, VK_TRUE, UINT64_MAX);
-  vkResetFences(globalDevice, 1, &fence);
+  // Only wait for the GPU to finish the frame that last used this slot,
+  // the other slots can still be in flight
+  {
+    ProfileScope wait(PhaseFenceWait);
+    graphicsTimeline.Wait(frame.timelineValue);
+  }
   //TransitionImage(imageIndex, _imageLayouts[imageIndex], VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
   ReleaseActiveBuffers();
+  ReleaseRetiredBuffers(false);
+  uploadQueue.Collect();
+  transientRing.BeginFrame(currentFrame);
+  for (VkCommandPool commandPool : frame.recordPools)
+    vkResetCommandPool(globalDevice, commandPool, 0);
 
-  vkAcquireNextImageKHR(globalDevice, _swapChain, UINT64_MAX, imageGet, nullptr, &imageIndex);
+  if (headless)
+  {
+    imageIndex = currentFrame;
+  }
+  else
+  {
+    ProfileScope acquire(PhaseAcquire);
+    DestroyRetiredSwapchains(false);
+    // Nothing is recorded yet, a skipped frame leaves the slot ready for the next BeginRenderPass
+    if (swapchainDirty && RecreateSwapChain() == false)
+      return false;
+    VkResult result = vkAcquireNextImageKHR(globalDevice, _swapChain, UINT64_MAX, frame.imageGet, nullptr, &imageIndex);
+    // Nothing was acquired and the semaphore stays unsignaled, so it can be used again
+    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+      if (RecreateSwapChain() == false)
+        return false;
+      result = vkAcquireNextImageKHR(globalDevice, _swapChain, UINT64_MAX, frame.imageGet, nullptr, &imageIndex);
+    }
+    // A suboptimal image is still presentable, the swapchain is replaced after this frame
+    if (result == VK_SUBOPTIMAL_KHR)
+      swapchainDirty = true;
+    else if (result != VK_SUCCESS)
+      throw std::runtime_error("failed to acquire a swapchain image!");
+  }
+
+  // The image may have come back before the frame that last rendered to it retired
+  if (graphicsTimeline.IsComplete(_imageValues[imageIndex]) == false)
+  {
+    ProfileScope wait(PhaseFenceWait);
+    graphicsTimeline.Wait(_imageValues[imageIndex]);
+  }
+
+  primaryBuffer = frame.commandBuffer;
   vkResetCommandBuffer(primaryBuffer, 0);
   //TransitionImage(imageIndex, _imageLayouts[imageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
   VkCommandBufferBeginInfo cmdBeginInfo = {};
@@ -782,15 +1947,17 @@ void VulkanInterface::BeginRenderPass()
   cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
 
   vkBeginCommandBuffer(primaryBuffer, &cmdBeginInfo);
+  // Reads back what this slot measured last time around, that frame has already completed
+  gpuTimer.BeginFrame(primaryBuffer, currentFrame, _frame);
 
   VkRect2D draw = {
     {0,0},
-    surfaceCapabilities.maxImageExtent
+    renderExtent
   };
 
   VkClearValue clear[2]{};
   clear[0].color = { 0, 0, 0, 1 };
-  clear[1].depthStencil = { 1, 0 };
+  clear[1].depthStencil = { reverseZ ? 0.0f : 1.0f, 0 };
   VkRenderPassBeginInfo beginInfo{};
 
   beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -801,57 +1968,48 @@ void VulkanInterface::BeginRenderPass()
   beginInfo.clearValueCount = 2;
   beginInfo.pClearValues = clear;
 
-  vkCmdBeginRenderPass(primaryBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
-  VkRect2D scissor = { {0,0}, surfaceCapabilities.maxImageExtent };
-  VkViewport port = { 0,0,
-    static_cast<float>(surfaceCapabilities.maxImageExtent.width),
-    static_cast<float>(surfaceCapabilities.maxImageExtent.height), 0, 1 };
-
-  vkCmdBindPipeline(primaryBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ActivePipelines[activePipeline]);
-  vkCmdSetScissor(primaryBuffer, 0, 1, &scissor);
-  vkCmdSetViewport(primaryBuffer, 0, 1, &port);
+  boundPipeline = VK_NULL_HANDLE;
+  activeVariant = StandardPipeline;
+  activeTopology = Triangle;
+  activeBlend = false;
+  activeMaterial = 0;
   _isRendering = true;
+
+  // With parallel recording the subpass may only execute secondary buffers,
+  // they set their own state when the queue is flushed
+  gpuTimer.BeginRenderPass(primaryBuffer);
+  if (recordingThreads > 1)
+  {
+    vkCmdBeginRenderPass(primaryBuffer, &beginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    return true;
+  }
+  vkCmdBeginRenderPass(primaryBuffer, &beginInfo, VK_SUBPASS_CONTENTS_INLINE);
+  // Every pipeline shares the layout, so the frame's set stays bound across pipeline changes
+  vkCmdBindDescriptorSets(primaryBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+
+  // Pipelines and dynamic state don't carry over between command buffers.
+  // The pre-pass starts in the depth subpass, where no color pipeline may be bound
+  if (depthPrePass == false)
+    BindPipeline();
+  vkCmdSetPrimitiveTopology(primaryBuffer, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  SetViewportState(primaryBuffer);
+  return true;
 }
 
-bufferInfo  VulkanInterface::CreateVertexBuffer(int VertexCount)
+void VulkanInterface::SetViewportState(VkCommandBuffer buffer)
 {
-  std::array<uint32_t, 1> indicies = { 0 };
-
-  VmaAllocation bufferAllocation{};
-
-  VkMemoryRequirements memRec{};
-  memRec.size = VertexCount * sizeof(Vertex);
-  memRec.alignment = 0;
-
-  VmaAllocationCreateInfo allocationInfo{};
-  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO;
-  allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
-  allocationInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
-  allocationInfo.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
-
-  VmaAllocationInfo AllocInfo;
-
-
-  VkBuffer vertexBuffer;
-  VkBufferCreateInfo bufferCreate{};
-  bufferCreate.size = VertexCount * sizeof(Vertex);
-  bufferCreate.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-  bufferCreate.queueFamilyIndexCount = static_cast<uint32_t>(indicies.size());
-  bufferCreate.pQueueFamilyIndices = indicies.data();
-  bufferCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-  bufferCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  vmaCreateBuffer(allocator, &bufferCreate, &allocationInfo, &vertexBuffer, &bufferAllocation, &AllocInfo);
-  activeBuffers.push_back({ vertexBuffer, bufferAllocation, memRec.size });
-  return { vertexBuffer, bufferAllocation, memRec.size };
+  VkRect2D scissor = { {0,0}, renderExtent };
+  VkViewport port = { 0,0,
+    static_cast<float>(renderExtent.width),
+    static_cast<float>(renderExtent.height), 0, 1 };
+  vkCmdSetScissor(buffer, 0, 1, &scissor);
+  vkCmdSetViewport(buffer, 0, 1, &port);
 }
 
 void VulkanInterface::DrawRect(glm::vec2 pos, glm::vec2 size, glm::vec4 color)
 {
-  UpdatePushConstants();
   if (!_isRendering)
     throw std::runtime_error("Cannot draw without a render pass started");
-  bufferInfo buffer = CreateVertexBuffer(6);
-  void* data = NULL;
   std::array<Vertex, 6> vertexs = {};
   vertexs[0] = { {pos.x - size.x / 2.0f, pos.y - size.y / 2.0f, 1}, color };
   vertexs[1] = { {pos.x - size.x / 2.0f, pos.y + size.y / 2.0f, 1}, color };
@@ -859,14 +2017,22 @@ void VulkanInterface::DrawRect(glm::vec2 pos, glm::vec2 size, glm::vec4 color)
   vertexs[3] = { {pos.x + size.x / 2.0f, pos.y + size.y / 2.0f, 1}, color };
   vertexs[4] = { {pos.x + size.x / 2.0f, pos.y - size.y / 2.0f, 1}, color };
   vertexs[5] = { {pos.x - size.x / 2.0f, pos.y - size.y / 2.0f, 1}, color };
-  vmaMapMemory(allocator, buffer.memory, &data);
-  memcpy(data, vertexs.data(), sizeof(Vertex) * vertexs.size());
-  VkBuffer buffers[2] = { buffer.buffer, 0 };
-  VkDeviceSize ComBuffOffset = 0;
+  if (IsQueueing())
+  {
+    Draw(std::vector<Vertex>(vertexs.begin(), vertexs.end()));
+    return;
+  }
+  ProfileScope record(PhaseRecord);
+  PushDrawConstants();
+  ringAllocation buffer{};
+  {
+    ProfileScope upload(PhaseUpload);
+    buffer = AllocateVertices(vertexs.size());
+    PackedVertex::Pack(static_cast<PackedVertex*>(buffer.data), vertexs.data(), vertexs.size());
+  }
 
-  vkCmdBindVertexBuffers(primaryBuffer, 0, 1, &buffer.buffer, &ComBuffOffset);
+  BindVertexStreams(primaryBuffer, InterleavedBinding(buffer.buffer, buffer.offset), false);
   vkCmdDraw(primaryBuffer, static_cast<uint32_t>(vertexs.size()), 1, 0, 0);
-  vmaUnmapMemory(allocator, buffer.memory);
   //for (int i = 0; i < 6; ++i)
   //{
   //  Vertex* v = reinterpret_cast<Vertex*>(data) + i;
@@ -886,6 +2052,7 @@ void VulkanInterface::ReleaseVertexBuffer(bufferInfo in)
 
 void VulkanInterface::ReleaseActiveBuffers(void)
 {
+  std::vector<bufferInfo>& activeBuffers = frames[currentFrame].activeBuffers;
   for (int i = 0; i < activeBuffers.size(); i++)
   {
     ReleaseVertexBuffer(activeBuffers[i]);
@@ -898,23 +2065,52 @@ void VulkanInterface::EndRenderPass()
   if (!_isRendering)
     throw std::runtime_error("Cannot end submit an unstarted renderpass");
 
-  vkCmdEndRenderPass(primaryBuffer);
-  VkSemaphore waitSemas[] = { imageGet };
-  VkSemaphore signalSema[] = { presentSemaphore };
-  // Submit for draw
-  VkSubmitInfo subInfo{};
-  std::array<VkPipelineStageFlags, 1> waitStages = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-  subInfo.commandBufferCount = 1;
-  subInfo.pCommandBuffers = &primaryBuffer;
-  subInfo.pWaitDstStageMask = waitStages.data();
-  subInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  subInfo.signalSemaphoreCount = 1;
-  subInfo.pSignalSemaphores = signalSema;
-  subInfo.pWaitSemaphores = waitSemas;
-  subInfo.waitSemaphoreCount = 1;
-
-  vkEndCommandBuffer(primaryBuffer);
-  vkQueueSubmit(queues[0], 1, &subInfo, fence);
+  frameData& frame = frames[currentFrame];
+  {
+    ProfileScope record(PhaseRecord);
+    FlushDrawQueue();
+    vkCmdEndRenderPass(primaryBuffer);
+    gpuTimer.EndRenderPass(primaryBuffer);
+    vkEndCommandBuffer(primaryBuffer);
+  }
+  timelineWaits waits;
+  // Nothing to acquire from or present to in headless mode
+  if (headless == false)
+    waits.Add(frame.imageGet, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  // Buffers uploaded since the last frame are taken over from the transfer queue first
+  std::array<VkCommandBuffer, 2> submitBuffers = { frame.acquireBuffer, primaryBuffer };
+  uint32_t bufferCount = 1;
+  uploadWait uploads{};
+  if (uploadQueue.Submit(frame.acquireBuffer, &uploads))
+  {
+    waits.Add(uploads.semaphore, uploads.value, uploads.stages);
+    bufferCount = 2;
+  }
+
+  {
+    ProfileScope submit(PhaseSubmit);
+    WriteFrameUniforms(frame);
+    transientRing.Flush();
+    // Submit for draw
+    frame.timelineValue = graphicsTimeline.Submit(submitBuffers.data() + (2 - bufferCount), bufferCount, waits, headless ? VK_NULL_HANDLE : _presentSemaphores[imageIndex]);
+  }
+  _imageValues[imageIndex] = frame.timelineValue;
+  {
+    // Buffers released up to now are no longer used past this frame
+    std::lock_guard<std::mutex> guard(releaseLock);
+    for (pendingRelease& release : pendingReleases)
+      if (release.value == 0)
+        release.value = frame.timelineValue;
+  }
+  gpuTimer.EndFrame();
+  if (headless)
+  {
+    ++_frame;
+    currentFrame = (currentFrame + 1) % framesInFlight;
+    _isRendering = false;
+    CpuProfiler::Get().EndFrame();
+    return;
+  }
 
   VkSwapchainKHR swapChains[] = { _swapChain };
   VkPresentInfoKHR presInfo{};
@@ -922,17 +2118,18 @@ void VulkanInterface::EndRenderPass()
   presInfo.swapchainCount = 1;
   presInfo.pSwapchains = swapChains;
   presInfo.pImageIndices = &imageIndex;
-  presInfo.pWaitSemaphores = signalSema;
+  presInfo.pWaitSemaphores = &_presentSemaphores[imageIndex];
   presInfo.waitSemaphoreCount = 1;
-  VkResult result{};
-  presInfo.pResults = &result;
-  vkQueuePresentKHR(queues[0], &presInfo);
+  {
+    ProfileScope present(PhasePresent);
+    VkResult result = graphicsTimeline.Present(presInfo);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+      swapchainDirty = true;
+  }
   ++_frame;
+  currentFrame = (currentFrame + 1) % framesInFlight;
   _isRendering = false;
-
-  UpdatePushConstants();
-
-
+  CpuProfiler::Get().EndFrame();
 }
 
 VkCommandBuffer VulkanInterface::CreateSingleBuffer()
@@ -967,12 +2164,8 @@ void VulkanInterface::EndSingleBuffer(VkCommandBuffer buffer)
 {
   vkEndCommandBuffer(buffer);
 
-  VkSubmitInfo submitInfo{};
-  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &buffer;
-  vkQueueSubmit(queues[0], 1, &submitInfo, VK_NULL_HANDLE);
-  vkQueueWaitIdle(queues[0]);
+  // Only this submission is waited for, the queue keeps running later work
+  graphicsTimeline.Wait(graphicsTimeline.Submit(&buffer, 1, timelineWaits{}));
 
   vkFreeCommandBuffers(globalDevice, pool, 1, &buffer);
 }
@@ -1012,23 +2205,309 @@ void VulkanInterface::SetActiveCamera(Camera c)
   activeCamera = c;
 }
 
-void VulkanInterface::Draw(std::vector<Vertex> const& vertexes)
+void VulkanInterface::Draw(std::vector<Vertex> const& vertexes, uint32_t instanceCount)
+{
+  if (!_isRendering)
+    throw std::runtime_error("Cannot draw without a render pass started");
+  ProfileScope record(PhaseRecord);
+  ringAllocation buffer{};
+  {
+    ProfileScope upload(PhaseUpload);
+    buffer = AllocateVertices(vertexes.size());
+    PackedVertex::Pack(static_cast<PackedVertex*>(buffer.data), vertexes.data(), vertexes.size());
+  }
+  DrawTransient(buffer, static_cast<uint32_t>(vertexes.size()), instanceCount);
+}
+
+void VulkanInterface::Draw(vertexStreamView const& vertexes, uint32_t instanceCount)
+{
+  if (!_isRendering)
+    throw std::runtime_error("Cannot draw without a render pass started");
+  ProfileScope record(PhaseRecord);
+  ringAllocation buffer{};
+  {
+    ProfileScope upload(PhaseUpload);
+    buffer = AllocateVertices(vertexes.size());
+    PackedVertex::Pack(static_cast<PackedVertex*>(buffer.data), vertexes);
+  }
+  DrawTransient(buffer, static_cast<uint32_t>(vertexes.size()), instanceCount);
+}
+
+ringAllocation VulkanInterface::AllocateVertices(size_t count)
+{
+  return AllocateTransient(sizeof(PackedVertex) * count, IsQueueing() ? sizeof(PackedVertex) : sizeof(float));
+}
+
+void VulkanInterface::DrawTransient(ringAllocation const& vertexes, uint32_t vertexCount, uint32_t instanceCount)
+{
+  if (IsQueueing())
+  {
+    VkDeviceSize base = (vertexes.buffer == transientRing.GetBuffer()) ? transientRing.GetRegionBase() : 0;
+    queuedDraw draw{};
+    draw.vertices = InterleavedBinding(vertexes.buffer, base);
+    draw.vertexOffset = static_cast<int32_t>((vertexes.offset - base) / sizeof(PackedVertex));
+    draw.count = vertexCount;
+    draw.instanceCount = instanceCount;
+    QueueDraw(draw);
+    return;
+  }
+  PushDrawConstants();
+
+  BindVertexStreams(primaryBuffer, InterleavedBinding(vertexes.buffer, vertexes.offset), false);
+  vkCmdDraw(primaryBuffer, vertexCount, instanceCount, 0, 0);
+}
+
+static objectTransform AsObject(Transform const& transform) { return transform.GetObjectTransform(); }
+static objectTransform const& AsObject(objectTransform const& transform) { return transform; }
+
+void VulkanInterface::DrawInstanced(Mesh& mesh, std::span<const Transform> instances)
+{
+  DrawInstancedFrom(mesh, instances);
+}
+
+void VulkanInterface::DrawInstanced(Mesh& mesh, std::span<const objectTransform> instances)
+{
+  DrawInstancedFrom(mesh, instances);
+}
+
+template<typename T>
+void VulkanInterface::DrawInstancedFrom(Mesh& mesh, std::span<const T> instances)
+{
+  if (!_isRendering)
+    throw std::runtime_error("Cannot draw without a render pass started");
+  if (instances.empty())
+    return;
+  ProfileScope record(PhaseRecord);
+
+  if (IsQueueing())
+  {
+    // Instances are just consecutive objects, the mesh's queued draw points at the first one
+    instanceObjectBase = static_cast<uint32_t>(queuedObjects.size());
+    for (T const& instance : instances)
+      queuedObjects.push_back(AsObject(instance));
+    mesh.Draw(static_cast<uint32_t>(instances.size()));
+    instanceObjectBase = UINT32_MAX;
+    return;
+  }
+
+  // One model and normal matrix per instance, fed to the shader as an instance rate stream
+  ringAllocation instanceData{};
+  {
+    ProfileScope upload(PhaseUpload);
+    instanceData = AllocateTransient(sizeof(objectTransform) * instances.size(), 16);
+    objectTransform* transforms = static_cast<objectTransform*>(instanceData.data);
+    for (size_t i = 0; i < instances.size(); ++i)
+      transforms[i] = AsObject(instances[i]);
+  }
+  VkDeviceSize instanceStride = sizeof(objectTransform);
+  vkCmdBindVertexBuffers2(primaryBuffer, InstanceBinding, 1, &instanceData.buffer, &instanceData.offset, nullptr, &instanceStride);
+
+  activeVariant = InstancedPipeline;
+  BindPipeline();
+  mesh.Draw(static_cast<uint32_t>(instances.size()));
+  activeVariant = StandardPipeline;
+  BindPipeline();
+}
+
+void VulkanInterface::DrawIndexed(std::vector<Vertex> const& vertexes, std::vector<uint32_t> const& indexes, uint32_t instanceCount)
+{
+  if (!_isRendering)
+    throw std::runtime_error("Cannot draw without a render pass started");
+  ProfileScope record(PhaseRecord);
+  ringAllocation buffer{};
+  {
+    ProfileScope upload(PhaseUpload);
+    buffer = AllocateVertices(vertexes.size());
+    PackedVertex::Pack(static_cast<PackedVertex*>(buffer.data), vertexes.data(), vertexes.size());
+  }
+  DrawIndexedTransient(buffer, vertexes.size(), indexes, instanceCount);
+}
+
+void VulkanInterface::DrawIndexed(vertexStreamView const& vertexes, std::span<const uint32_t> indexes, uint32_t instanceCount)
+{
+  if (!_isRendering)
+    throw std::runtime_error("Cannot draw without a render pass started");
+  ProfileScope record(PhaseRecord);
+  ringAllocation buffer{};
+  {
+    ProfileScope upload(PhaseUpload);
+    buffer = AllocateVertices(vertexes.size());
+    PackedVertex::Pack(static_cast<PackedVertex*>(buffer.data), vertexes);
+  }
+  DrawIndexedTransient(buffer, vertexes.size(), indexes, instanceCount);
+}
+
+void VulkanInterface::DrawIndexedTransient(ringAllocation const& vertexes, size_t vertexCount, std::span<const uint32_t> indexes, uint32_t instanceCount)
+{
+  VkIndexType type = SelectIndexType(vertexCount);
+  ringAllocation indexBuffer{};
+  {
+    ProfileScope upload(PhaseUpload);
+    indexBuffer = AllocateTransient(IndexSize(type) * indexes.size(), sizeof(uint32_t));
+    WriteIndices(indexBuffer.data, indexes, type);
+  }
+
+  if (IsQueueing())
+  {
+    VkDeviceSize base = (vertexes.buffer == transientRing.GetBuffer()) ? transientRing.GetRegionBase() : 0;
+    queuedDraw draw{};
+    draw.vertices = InterleavedBinding(vertexes.buffer, base);
+    draw.vertexOffset = static_cast<int32_t>((vertexes.offset - base) / sizeof(PackedVertex));
+    draw.indexBuffer = indexBuffer.buffer;
+    draw.indexType = type;
+    draw.firstIndex = static_cast<uint32_t>(indexBuffer.offset / IndexSize(type));
+    draw.count = static_cast<uint32_t>(indexes.size());
+    draw.instanceCount = instanceCount;
+    QueueDraw(draw);
+    return;
+  }
+  PushDrawConstants();
+
+  BindVertexStreams(primaryBuffer, InterleavedBinding(vertexes.buffer, vertexes.offset), false);
+  vkCmdBindIndexBuffer(primaryBuffer, indexBuffer.buffer, indexBuffer.offset, type);
+  vkCmdDrawIndexed(primaryBuffer, static_cast<uint32_t>(indexes.size()), instanceCount, 0, 0, 0);
+}
+
+void VulkanInterface::DrawIndexedBuffer(vertexBinding const& vertexes, bufferInfo const& indexes, uint32_t indexCount, VkIndexType type, uint32_t instanceCount)
+{
+  if (!_isRendering)
+    throw std::runtime_error("Cannot draw without a render pass started");
+  ProfileScope record(PhaseRecord);
+  if (IsQueueing())
+  {
+    queuedDraw draw{};
+    draw.vertices = vertexes;
+    draw.indexBuffer = indexes.buffer;
+    draw.indexType = type;
+    draw.count = indexCount;
+    draw.instanceCount = instanceCount;
+    QueueDraw(draw);
+    return;
+  }
+  PushDrawConstants();
+
+  BindVertexStreams(primaryBuffer, vertexes, false);
+  vkCmdBindIndexBuffer(primaryBuffer, indexes.buffer, 0, type);
+  vkCmdDrawIndexed(primaryBuffer, indexCount, instanceCount, 0, 0, 0);
+}
+
+void VulkanInterface::WriteIndices(void* dst, std::span<const uint32_t> indexes, VkIndexType type)
+{
+  if (type == VK_INDEX_TYPE_UINT32)
+  {
+    memcpy(dst, indexes.data(), sizeof(uint32_t) * indexes.size());
+    return;
+  }
+  uint16_t* narrow = static_cast<uint16_t*>(dst);
+  for (size_t i = 0; i < indexes.size(); ++i)
+    narrow[i] = static_cast<uint16_t>(indexes[i]);
+}
+
+vertexBinding VulkanInterface::InterleavedBinding(VkBuffer buffer, VkDeviceSize offset)
+{
+  vertexBinding binding{};
+  binding.buffer = buffer;
+  binding.offsets = { offset + offsetof(PackedVertex, pos), offset + offsetof(PackedVertex, color), offset + offsetof(PackedVertex, normal) };
+  binding.strides.fill(sizeof(PackedVertex));
+  return binding;
+}
+
+vertexBinding VulkanInterface::StreamBinding(VkBuffer buffer, size_t vertexCount)
+{
+  vertexBinding binding{};
+  binding.buffer = buffer;
+  binding.offsets = VertexStreams::GpuOffsets(vertexCount);
+  binding.strides = VertexStreams::GpuStrides;
+  return binding;
+}
+
+void VulkanInterface::BindVertexStreams(VkCommandBuffer buffer, vertexBinding const& binding, bool positionOnly)
+{
+  std::array<VkBuffer, VertexStreamCount> buffers;
+  buffers.fill(binding.buffer);
+  uint32_t count = positionOnly ? 1 : VertexStreamCount;
+  vkCmdBindVertexBuffers2(buffer, 0, count, buffers.data(), binding.offsets.data(), nullptr, binding.strides.data());
+}
+
+void VulkanInterface::DrawBuffer(vertexBinding const& vertexes, uint32_t vertexCount, uint32_t instanceCount)
 {
-  UpdatePushConstants();
   if (!_isRendering)
     throw std::runtime_error("Cannot draw without a render pass started");
-  bufferInfo buffer = CreateVertexBuffer(vertexes.size());
-  void* data = NULL;
-  vmaMapMemory(allocator, buffer.memory, &data);
-  memcpy(data, vertexes.data(), sizeof(Vertex) * vertexes.size());
-  VkBuffer buffers[2] = { buffer.buffer, 0 };
-  VkDeviceSize ComBuffOffset = 0;
+  ProfileScope record(PhaseRecord);
+  if (IsQueueing())
+  {
+    queuedDraw draw{};
+    draw.vertices = vertexes;
+    draw.count = vertexCount;
+    draw.instanceCount = instanceCount;
+    QueueDraw(draw);
+    return;
+  }
+  PushDrawConstants();
+
+  BindVertexStreams(primaryBuffer, vertexes, false);
+  vkCmdDraw(primaryBuffer, vertexCount, instanceCount, 0, 0);
+}
 
-  vkCmdBindVertexBuffers(primaryBuffer, 0, 1, &buffer.buffer, &ComBuffOffset);
-  vkCmdDraw(primaryBuffer, static_cast<uint32_t>(vertexes.size()), 1, 0, 0);
-  vmaUnmapMemory(allocator, buffer.memory);
+bufferInfo VulkanInterface::CreateStaticBuffer(void const* data, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+  ProfileScope upload(PhaseUpload);
+  VkBufferCreateInfo bufferCreate{};
+  bufferCreate.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferCreate.size = size;
+  bufferCreate.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferCreate.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  VmaAllocationCreateInfo allocationInfo{};
+  allocationInfo.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+  allocationInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+  bufferInfo result{};
+  result.size = size;
+  if (vmaCreateBuffer(allocator, &bufferCreate, &allocationInfo, &result.buffer, &result.memory, nullptr) != VK_SUCCESS)
+    throw std::runtime_error("failed to create device local buffer!");
+
+  // The copy runs on the transfer queue, the next frame waits for it before reading
+  VkPipelineStageFlags stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+  VkAccessFlags access = VK_ACCESS_MEMORY_READ_BIT;
+  if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+  {
+    stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+  }
+  else if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+  {
+    stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    access = VK_ACCESS_INDEX_READ_BIT;
+  }
+  else if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+  {
+    stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    access = VK_ACCESS_SHADER_READ_BIT;
+  }
+  uploadQueue.Upload(result.buffer, 0, data, size, stages, access);
+  return result;
+}
 
+void VulkanInterface::ReleaseStaticBuffer(bufferInfo const& buffer)
+{
+  // The frame being recorded (or the next one) may still use it, as may its pending
+  // upload, so it is stamped with that frame's value at submit
+  std::lock_guard<std::mutex> guard(releaseLock);
+  pendingReleases.push_back({ 0, buffer });
+}
 
+void VulkanInterface::ReleaseRetiredBuffers(bool all)
+{
+  std::lock_guard<std::mutex> guard(releaseLock);
+  auto done = std::remove_if(pendingReleases.begin(), pendingReleases.end(), [&](pendingRelease& release)
+    {
+      if (all == false && (release.value == 0 || graphicsTimeline.IsComplete(release.value) == false))
+        return false;
+      ReleaseVertexBuffer(release.buffer);
+      return true;
+    });
+  pendingReleases.erase(done, pendingReleases.end());
 }
 
 void VulkanInterface::TransitionImage(uint32_t image, VkImageLayout old, VkImageLayout newL)
@@ -1096,47 +2575,47 @@ void VulkanInterface::TransitionImage(uint32_t image, VkImageLayout old, VkImage
   EndSingleBuffer(tempBuffer);
 }
 
-void VulkanInterface::UpdatePushConstants(void)
+void VulkanInterface::PushDrawConstants(void)
+{
+  vkCmdPushConstants(primaryBuffer, pipelayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(objectTransform), &drawConstant);
+}
+
+void VulkanInterface::UpdateCameraMatrices(void)
 {
   glm::mat4x4 camMat = activeCamera.GetMatrix();
   glm::vec3 camPos = camMat * glm::vec4(0, 0, 0, 1);
   glm::vec3 lookatPos = camMat * glm::vec4(0, 0, 2, 1);
-  windowSize = glm::vec2(surfaceCapabilities.currentExtent.width, surfaceCapabilities.currentExtent.width);
+  windowSize = glm::vec2(renderExtent.width, renderExtent.height);
   constantBuffer.viewProjection = glm::lookAt(camPos, lookatPos, glm::vec3(0, 1, 0)) * camMat;
-  constantBuffer.worldProjection = glm::perspective(activeCamera.fov, windowSize.x / windowSize.y, 1.0f, 1500.0f);
+  // Vulkan clip space depth is 0 to 1, reverse Z swaps the planes so near maps to 1
+  if (reverseZ)
+    constantBuffer.worldProjection = glm::perspectiveRH_ZO(activeCamera.fov, windowSize.x / windowSize.y, activeCamera.farPlane, activeCamera.nearPlane);
+  else
+    constantBuffer.worldProjection = glm::perspectiveRH_ZO(activeCamera.fov, windowSize.x / windowSize.y, activeCamera.nearPlane, activeCamera.farPlane);
+  constantBuffer.combinedProjection = constantBuffer.worldProjection * constantBuffer.viewProjection;
   //constantBuffer.viewProjection  = glm::transpose(constantBuffer.viewProjection);
   //constantBuffer.worldProjection = glm::transpose(constantBuffer.worldProjection);
-  vkCmdPushConstants(primaryBuffer, pipelayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uniformBuffer), &constantBuffer);
-  vkCmdPushConstants(primaryBuffer, pipelayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(uniformBuffer), sizeof(lightInfo), &lightInformation);
-
 }
 
-TopoClass getTopologyClass(VkPrimitiveTopology topology)
+void VulkanInterface::WriteFrameUniforms(frameData& frame)
 {
-  switch (topology)
-  {
-  case 0:
-    return Point;
-  case 1:
-  case 2:
-    return Line;
-  case 3:
-  case 4:
-  case 5:
-    return Triangle;
-  default:
-    return Triangle;
-  }
+  // Draws recorded before the camera or light changed still see the final values,
+  // the same as queued draws
+  UpdateCameraMatrices();
+  char* data = static_cast<char*>(frame.uniformData);
+  memcpy(data, &constantBuffer, sizeof(uniformBuffer));
+  memcpy(data + sizeof(uniformBuffer), &lightInformation, sizeof(lightInfo));
+  vmaFlushAllocation(allocator, frame.uniforms.memory, 0, sizeof(uniformBuffer) + sizeof(lightInfo));
 }
 
 void VulkanInterface::SetTopology(VkPrimitiveTopology topology)
 {
-  TopoClass clas = getTopologyClass(topology);
-
-  if (clas != activeTopology)
-  {
-    vkCmdBindPipeline(primaryBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, ActivePipelines[clas]);
-  }
+  currentTopology = topology;
+  activeTopology = getTopologyClass(topology);
+  // Queued draws pick their pipeline when the queue is flushed
+  if (IsQueueing())
+    return;
+  BindPipeline();
 
   vkCmdSetPrimitiveTopology(primaryBuffer, topology);
 }
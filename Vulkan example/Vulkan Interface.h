@@ -10,16 +10,31 @@
 #include <vma/vk_mem_alloc.h>
 #include <fstream>
 #include <vector>
+#include <span>
+#include <atomic>
+#include <mutex>
 
 #include "Camera.h"
 #include "Vertex.h"
-
-
+#include "Transform.h"
+#include "RingBuffer.h"
+#include "RadixSort.h"
+#include "ThreadPool.h"
+#include "GpuTimer.h"
+#include "PipelineCache.h"
+#include "ShaderRegistry.h"
+#include "UploadQueue.h"
+#include "Timeline.h"
+
+
+// Per frame uniform buffer (set 0, binding 1), written once before the frame is submitted.
+// The lightInfo follows it in the same buffer
 struct uniformBuffer 
 {
   glm::mat4x4 worldProjection;
   glm::mat4x4 viewProjection;
-  glm::mat4x4 objectPosition;
+  // worldProjection * viewProjection, so vertices take a single multiply
+  glm::mat4x4 combinedProjection;
 };
 constexpr int padSize = 1;
 struct lightInfo 
@@ -39,6 +54,31 @@ enum TopoClass
   Point = 2
 };
 
+// Shader and vertex input combinations, each gets a pipeline per TopoClass
+enum PipelineVariant
+{
+  StandardPipeline = 0,
+  InstancedPipeline = 1,
+  IndirectPipeline = 2,
+  // Position only, no fragment stage. Opaque only, built when the depth pre-pass is on
+  DepthPipeline = 3,
+  PipelineVariantCount
+};
+
+// Opaque and alpha blended, each variant gets a pipeline per blend mode
+constexpr int BlendModeCount = 2;
+
+typedef struct pipelineDesc
+{
+  std::string vertexShader;
+  std::string fragmentShader;
+  VertexInfo vertexInput;
+  uint32_t subpass;
+  bool depthOnly;       // No fragment shader and no color attachment
+}pipelineDesc;
+
+class Mesh;
+
 
 
 typedef struct bufferInfo 
@@ -48,6 +88,85 @@ typedef struct bufferInfo
   VkDeviceSize size;
 }bufferInfo;
 
+// Upper bound for SetFramesInFlight, sizes the per-frame resource ring
+constexpr uint32_t MaxFramesInFlight = 3;
+// Parallel recording doesn't split the draw queue finer than this
+constexpr size_t MinDrawsPerSlice = 64;
+// Labelled GPU scopes that can be timed in a single frame
+constexpr uint32_t MaxGpuScopes = 64;
+
+// Where each vertex stream of a draw is read from. Interleaved vertices point every stream into one buffer
+typedef struct vertexBinding
+{
+  VkBuffer buffer;
+  std::array<VkDeviceSize, VertexStreamCount> offsets;
+  std::array<VkDeviceSize, VertexStreamCount> strides;
+}vertexBinding;
+
+// A draw recorded in deferred or indirect mode, recorded at EndRenderPass
+typedef struct queuedDraw
+{
+  vertexBinding vertices;
+  VkBuffer indexBuffer;          // VK_NULL_HANDLE for non indexed draws
+  VkIndexType indexType;
+  VkPrimitiveTopology topology;
+  uint32_t count;                // Index count, or vertex count when not indexed
+  uint32_t firstIndex;
+  int32_t vertexOffset;          // First vertex when not indexed
+  uint32_t firstObject;          // Index of the first model matrix in the object buffer
+  uint32_t instanceCount;
+  uint16_t material;
+  bool blended;
+}queuedDraw;
+
+// Swapchain resources replaced by a recreation. Frames up to retiredValue may still
+// be reading them, they are destroyed once the graphics timeline reached it
+typedef struct retiredSwapchain
+{
+  VkSwapchainKHR swapchain;
+  std::vector<VkImageView> views;
+  std::vector<VkFramebuffer> framebuffers;
+  VkImage depthImage;
+  VmaAllocation depthMemory;
+  VkImageView depthView;
+  std::vector<VkSemaphore> presentSemaphores;
+  uint64_t retiredValue;
+}retiredSwapchain;
+
+// A static buffer waiting for the GPU, value is 0 until the frame that may use it is submitted
+typedef struct pendingRelease
+{
+  uint64_t value;
+  bufferInfo buffer;
+}pendingRelease;
+
+// Everything a single frame needs while the GPU may still be consuming it.
+// Nothing in here can be touched until the graphics timeline reached timelineValue.
+typedef struct frameData
+{
+  VkCommandBuffer commandBuffer;
+  // Takes ownership of the buffers uploaded on the transfer queue, submitted first
+  VkCommandBuffer acquireBuffer;
+  uint64_t timelineValue;   // Signaled by the frame's submission, 0 before the first
+  VkSemaphore imageGet;
+  std::vector<bufferInfo> activeBuffers;
+
+  // Indirect mode, per object model matrices (read through gl_InstanceIndex) and draw commands
+  VkDescriptorSet descriptorSet;
+  bufferInfo objectBuffer;
+  void* objectData;
+  bufferInfo indirectBuffer;
+  void* indirectData;
+
+  // Camera and light, a uniformBuffer followed by a lightInfo
+  bufferInfo uniforms;
+  void* uniformData;
+
+  // Parallel recording, a command pool and secondary buffer per recording thread
+  std::vector<VkCommandPool> recordPools;
+  std::vector<VkCommandBuffer> recordBuffers;
+}frameData;
+
 class VulkanInterface 
 {
 public:
@@ -55,14 +174,196 @@ public:
   ~VulkanInterface(void);
 
   void Initialize(void);
-  bufferInfo  CreateVertexBuffer(int VertexCount);
 
   // Draw a simple 2D rectangle on screen
   void DrawRect(glm::vec2 pos, glm::vec2 size, glm::vec4 color);
-  void Draw(std::vector<Vertex> const& vertexes);
+  void Draw(std::vector<Vertex> const& vertexes, uint32_t instanceCount = 1);
+  void DrawIndexed(std::vector<Vertex> const& vertexes, std::vector<uint32_t> const& indexes, uint32_t instanceCount = 1);
+  void Draw(vertexStreamView const& vertexes, uint32_t instanceCount = 1);
+  void DrawIndexed(vertexStreamView const& vertexes, std::span<const uint32_t> indexes, uint32_t instanceCount = 1);
+  // Draw from buffers that already live on the GPU, nothing is uploaded
+  void DrawBuffer(vertexBinding const& vertexes, uint32_t vertexCount, uint32_t instanceCount = 1);
+  void DrawIndexedBuffer(vertexBinding const& vertexes, bufferInfo const& indexes, uint32_t indexCount, VkIndexType type, uint32_t instanceCount = 1);
+
+  /*
+   * Draws the mesh once per transform in a single draw call.
+   * The model matrix from UpdateModelMatrix is ignored, each instance uses its own.
+   */
+  void DrawInstanced(Mesh& mesh, std::span<const Transform> instances);
+  // As above with matrices already worked out, such as a TransformHierarchy's world transforms
+  void DrawInstanced(Mesh& mesh, std::span<const objectTransform> instances);
+
+  // Smallest index type able to address vertexCount vertices
+  static VkIndexType SelectIndexType(size_t vertexCount)
+  {
+    return (vertexCount <= 0xFFFF) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  }
+  static VkDeviceSize IndexSize(VkIndexType type)
+  {
+    return (type == VK_INDEX_TYPE_UINT16) ? sizeof(uint16_t) : sizeof(uint32_t);
+  }
+  // Writes indexes to dst narrowed to the given index type
+  static void WriteIndices(void* dst, std::span<const uint32_t> indexes, VkIndexType type);
+  // PackedVertex data starting at offset
+  static vertexBinding InterleavedBinding(VkBuffer buffer, VkDeviceSize offset);
+  // vertexCount vertices written by VertexStreams::Pack at the start of buffer
+  static vertexBinding StreamBinding(VkBuffer buffer, size_t vertexCount);
+
+  /*
+   * Copies data into a new DEVICE_LOCAL buffer through a staging buffer.
+   * The returned buffer is owned by the caller and must be given back
+   * through ReleaseStaticBuffer.
+   */
+  bufferInfo CreateStaticBuffer(void const* data, VkDeviceSize size, VkBufferUsageFlags usage);
+  // Destroys the buffer once every frame that may still read it has retired
+  void ReleaseStaticBuffer(bufferInfo const& buffer);
+
+  /*
+   * Progress of the graphics queue. Every submission signals the next value of a
+   * timeline semaphore, waiting on one waits for everything submitted up to it.
+   * These may be called from any thread.
+   */
+  uint64_t GetSubmittedValue(void) const { return graphicsTimeline.Submitted(); }
+  uint64_t GetCompletedValue(void) { return graphicsTimeline.Completed(); }
+  bool IsValueComplete(uint64_t value) { return graphicsTimeline.IsComplete(value); }
+  void WaitForValue(uint64_t value) { graphicsTimeline.Wait(value); }
 
   void SetActiveCamera(Camera c);
 
+  /*
+   * Renders into offscreen images of the given size instead of a window.
+   * No SDL window, surface or swapchain is created, so this runs on machines
+   * without a display (or a GPU, through a software driver like lavapipe).
+   * Must be called before Initialize.
+   */
+  void SetHeadless(uint32_t width, uint32_t height);
+  bool IsHeadless(void) const { return headless; }
+  // Copies the last rendered frame out as tightly packed RGBA8 rows, headless mode only
+  void ReadPixels(std::vector<uint8_t>& pixels);
+
+  /*
+   * Sets how many frames the CPU may record ahead of the GPU (1 - MaxFramesInFlight).
+   * Must be called before Initialize.
+   */
+  void SetFramesInFlight(uint32_t count);
+
+  /*
+   * File the pipeline cache is loaded from at Initialize and saved to after
+   * pipelines are built and on shutdown. Must be called before Initialize.
+   */
+  void SetPipelineCachePath(std::string const& path);
+
+  /*
+   * Shader pack mapped at Initialize, shaders not compiled into the binary
+   * are taken from it before falling back to ./Shaders. Must be called before Initialize.
+   */
+  void SetShaderPackPath(std::string const& path);
+
+  /*
+   * Format of the depth attachment. VK_FORMAT_UNDEFINED (the default) picks the
+   * most precise format the device supports. Must be called before Initialize.
+   */
+  void SetDepthFormat(VkFormat format);
+  VkFormat GetDepthFormat(void) const { return depthFormat; }
+
+  /*
+   * Reverse Z maps the near plane to 1 and the far plane to 0, clears depth to 0
+   * and tests with GREATER. Float depth then has its precision where the projection
+   * loses it. On by default. Must be called before Initialize.
+   */
+  void SetReverseZ(bool enabled);
+  bool GetReverseZ(void) const { return reverseZ; }
+
+  /*
+   * Renders the opaque queued draws depth only with a position only shader first,
+   * then shades everything with an EQUAL depth test, so every covered pixel runs the
+   * fragment shader once. Draws are queued like deferred mode while it is on.
+   * Must be called before Initialize.
+   */
+  void SetDepthPrePass(bool enabled);
+  bool GetDepthPrePass(void) const { return depthPrePass; }
+  uint32_t GetFramesInFlight(void) const { return framesInFlight; }
+
+  /*
+   * Present mode of the swapchain, falls back to FIFO when the surface doesn't
+   * support it. MAILBOX and IMMEDIATE don't wait for vertical blank, FIFO_RELAXED
+   * only waits when the frame was on time. Called after Initialize, the swapchain
+   * is replaced before the next frame.
+   */
+  void SetPresentMode(VkPresentModeKHR mode);
+  // The mode actually in use
+  VkPresentModeKHR GetPresentMode(void) const { return presentMode; }
+
+  /*
+   * Swap images to ask for, 2 for double and 3 for triple buffering. 0 (the
+   * default) takes the surface minimum. Clamped to what the surface allows.
+   * Called after Initialize, the swapchain is replaced before the next frame.
+   */
+  void SetSwapImageCount(uint32_t count);
+  uint32_t GetSwapImageCount(void) const { return swapImageCount; }
+
+  // Replaces the swapchain before the next frame, for resizes the surface doesn't report
+  void OnWindowResized(void) { swapchainDirty = true; }
+
+  /*
+   * Sets how many bytes of transient vertex data each frame can sub-allocate
+   * before draws fall back to individual buffers. Must be called before Initialize.
+   */
+  void SetTransientRingSize(VkDeviceSize bytesPerFrame);
+  ringStats GetTransientStats(void) const { return transientRing.GetStats(); }
+
+  /*
+   * In indirect mode draws are not recorded as they are issued. They are collected
+   * for the whole frame and submitted at EndRenderPass with one multi draw indirect
+   * call per group of draws sharing geometry buffers and topology class.
+   * Draw order between groups is not preserved.
+   * Devices without drawIndirectFirstInstance still queue and sort the draws,
+   * but record them with direct draw calls.
+   */
+  void SetIndirectMode(bool enabled) { indirectMode = enabled; }
+  bool GetIndirectMode(void) const { return indirectMode; }
+
+  /*
+   * In deferred mode draws are queued with a 64 bit sort key (blend, topology,
+   * material, depth bucket, mesh) and radix sorted at EndRenderPass before being
+   * recorded. Opaque draws go front to back, blended ones back to front after them,
+   * and pipeline and buffer binds only happen when the sorted state changes.
+   * Combined with indirect mode the sorted queue is submitted with multi draw indirect.
+   */
+  void SetDeferredMode(bool enabled) { deferredMode = enabled; }
+  bool GetDeferredMode(void) const { return deferredMode; }
+
+  // Alpha blending for the following draws, reset to opaque every frame
+  void SetBlending(bool blended);
+  // Sort hint for queued draws, draws sharing a material are kept together. Reset to 0 every frame
+  void SetMaterial(uint16_t material) { activeMaterial = material; }
+
+  /*
+   * With more than one thread draws are queued like in deferred mode and the sorted
+   * queue is split across the threads at EndRenderPass. Every thread records its slice
+   * into a secondary command buffer from its own command pool and the primary buffer
+   * executes them. Must be called before Initialize.
+   */
+  void SetRecordingThreads(uint32_t count);
+  uint32_t GetRecordingThreads(void) const { return recordingThreads; }
+
+  /*
+   * Times the commands recorded between the calls on the GPU, scopes can nest.
+   * Draws queued by the deferred, indirect and parallel modes are recorded at
+   * EndRenderPass, so only the whole render pass time covers them.
+   * Ignored while recording in parallel.
+   */
+  void BeginGpuScope(char const* label);
+  void EndGpuScope(void);
+
+  /*
+   * GPU timings of the most recent frame that finished, which is the one
+   * submitted frames in flight frames ago. Empty if the device has no timestamps.
+   */
+  gpuFrameTiming const& GetGpuTiming(void) const { return gpuTimer.GetLatest(); }
+  std::deque<gpuFrameTiming> const& GetGpuTimingHistory(void) const { return gpuTimer.GetHistory(); }
+  void SetGpuTimingHistoryLength(size_t frames) { gpuTimer.SetHistoryLength(frames); }
+
   void SetLightPosition(glm::vec4 pos)
   {
     lightInformation.lightPosition = pos * glm::vec4(-1, -1, 1, 1);
@@ -75,9 +376,11 @@ public:
 
   /*
    * Must be called before any render commands are submitted.
-   * Tells the interface to begin accepting render commands
+   * Tells the interface to begin accepting render commands.
+   * Returns false when the window is minimized and the application is quitting,
+   * there is nothing to render to and neither draws nor EndRenderPass may follow
    */
-  void BeginRenderPass();
+  bool BeginRenderPass();
 
   /*
    * Must be called after all render commands are submitted.
@@ -89,16 +392,10 @@ public:
 
   void UpdateModelMatrix(glm::vec3 const& pos, glm::vec3 const& rotDeg, glm::vec3 const& scale) 
   {
-    glm::vec3 local = glm::radians(rotDeg);
-    glm::vec3 localPos = pos;
-    localPos.x *= -1, localPos.y *= -1;
-    constantBuffer.objectPosition  = glm::identity<glm::mat4x4>();
-    constantBuffer.objectPosition = glm::translate(constantBuffer.objectPosition, localPos);
-    constantBuffer.objectPosition = glm::rotate(constantBuffer.objectPosition, local.x, { 0,0,1 });
-    constantBuffer.objectPosition = glm::rotate(constantBuffer.objectPosition, local.y, { 1,0,0 });
-    constantBuffer.objectPosition = glm::rotate(constantBuffer.objectPosition, local.z, { 0,1,0 });
-    constantBuffer.objectPosition = glm::scale(constantBuffer.objectPosition, scale);
+    drawConstant = Transform{ pos, rotDeg, scale }.GetObjectTransform();
   }
+  // Model matrix kept elsewhere, such as a TransformHierarchy node
+  void SetModelTransform(objectTransform const& transform) { drawConstant = transform; }
 
   Camera& GetCamera() { return activeCamera; }
 
@@ -110,22 +407,67 @@ private:
   glm::vec2 windowSize;
   Camera activeCamera;
   uniformBuffer constantBuffer;
+  // Pushed per draw in immediate mode, queued draws copy it into the object buffer
+  objectTransform drawConstant;
   lightInfo lightInformation;
   VkDevice globalDevice;
   VkPhysicalDevice physicalDevice;
-  VkFence fence;
-  VkSemaphore presentSemaphore;
-  VkSemaphore imageGet;
+  uint32_t framesInFlight = 2;
+  uint32_t currentFrame = 0;
+  std::array<frameData, MaxFramesInFlight> frames;
   uint32_t imageIndex;
   VkSurfaceFormatKHR surfaceFormat;
   VkCommandBuffer primaryBuffer;
   VkPipeline ParentPipeline;
-  std::array<VkPipeline, 3> ActivePipelines;
-  int activePipeline;
+  // Resolved handles, VK_NULL_HANDLE until GetPipeline has waited on the build
+  std::array<std::array<std::array<VkPipeline, 3>, BlendModeCount>, PipelineVariantCount> ActivePipelines;
+  std::array<std::array<std::array<std::future<VkPipeline>, 3>, BlendModeCount>, PipelineVariantCount> pipelineBuilds;
+  ThreadPool buildPool;
+  std::atomic<uint32_t> pendingBuilds{ 0 };
+  PipelineVariant activeVariant;
+  bool activeBlend = false;
+  uint16_t activeMaterial = 0;
   TopoClass activeTopology;
+  VkPipeline boundPipeline;
   VkPipelineLayout pipelayout;
+  VkDescriptorSetLayout descriptorSetLayout;
+  VkDescriptorPool descriptorPool;
+  VkPrimitiveTopology currentTopology;
+
+  bool indirectMode = false;
+  bool deferredMode = false;
+  bool multiDrawSupported = false;
+  // Needed for the object index indirect commands pass in firstInstance
+  bool indirectFirstInstance = false;
+  uint32_t maxDrawIndirectCount = 1;
+  std::vector<queuedDraw> drawQueue;
+  std::vector<objectTransform> queuedObjects;
+  // Set while DrawInstanced forwards to the mesh, the instance matrices are already queued
+  uint32_t instanceObjectBase = UINT32_MAX;
+  template<typename T>
+  void DrawInstancedFrom(Mesh& mesh, std::span<const T> instances);
+  std::vector<sortEntry> sortEntries;
+  std::vector<sortEntry> sortScratch;
+  std::vector<queuedDraw> sortedDraws;
+  uint32_t recordingThreads = 1;
+  ThreadPool recordPool;
+  GpuTimer gpuTimer;
+  PipelineCache pipelineCache;
+  std::string pipelineCachePath = "./pipeline.cache";
+  ShaderRegistry shaderRegistry;
+  std::string shaderPackPath = "./Shaders/shaders.pack";
+
+  // One depth target shared by every frame, the render pass orders their use of it
+  VkFormat depthFormat = VK_FORMAT_UNDEFINED;
+  bool reverseZ = true;
+  bool depthPrePass = false;
+  VkImage depthImage = VK_NULL_HANDLE;
+  VmaAllocation depthMemory = VK_NULL_HANDLE;
+  VkImageView depthView = VK_NULL_HANDLE;
 
   VkSurfaceCapabilitiesKHR surfaceCapabilities;
+  VkExtent2D renderExtent;
+  bool headless = false;
   std::vector<VkQueue> queues;
   vk::Instance instance;
   vk::SurfaceKHR surface;
@@ -136,15 +478,37 @@ private:
   
   uint32_t swapImageCount = 0;
   VkSwapchainKHR _swapChain;
+  VkPresentModeKHR requestedPresentMode = VK_PRESENT_MODE_FIFO_KHR;
+  VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+  uint32_t requestedImageCount = 0;
+  // Set by out of date or suboptimal results and settings changes
+  bool swapchainDirty = false;
+  std::vector<retiredSwapchain> retiredSwapchains;
   std::vector<VkImage> _swapImages;
   std::vector<VkImageView> _swapImageViews;
+  // Signaled by the frame rendering to each swap image and waited on by its present.
+  // The image can't be acquired again before that present consumed it
+  std::vector<VkSemaphore> _presentSemaphores;
   std::vector<VkImageLayout> _imageLayouts;
+  // Backing memory of the swap images when they are offscreen targets
+  std::vector<VmaAllocation> _offscreenMemory;
+  RingBuffer transientRing;
+  VkDeviceSize transientRingSize = 4 * 1024 * 1024;
+  // Graphics timeline value signaled by the frame that last rendered to each swap image,
+  // waited on before the image is rendered to again
+  std::vector<uint64_t> _imageValues;
   VkRenderPass currentRenderPass;
 
 
-  std::vector<bufferInfo> activeBuffers{};
-
-  uint32_t queueCount = 0;
+  uint32_t graphicsFamily = 0;
+  uint32_t transferFamily = 0;
+  Timeline graphicsTimeline;
+  // Unused when the device has a single queue, uploads then go through graphicsTimeline
+  Timeline transferTimeline;
+  UploadQueue uploadQueue;
+  std::vector<pendingRelease> pendingReleases;
+  std::mutex releaseLock;
+  uint32_t GraphicsFamily(void) const { return graphicsFamily; }
   void CreateInstance(void);
   void CreateSurface(void);
   void CreateDevice(void);
@@ -153,12 +517,58 @@ private:
   void CreateRenderPass(void);
   void CreateCommandPool(void);
   void CreateSwapChain(void);
+  bool RecreateSwapChain(void);
+  void DestroyRetiredSwapchains(bool all);
+  VkExtent2D SelectExtent(void);
+  VkPresentModeKHR SelectPresentMode(void);
+  void CreateShaderRegistry(void);
+  void CreateOffscreenTargets(void);
+  void CreateDepthTarget(void);
+  VkFormat SelectDepthFormat(void);
   void CreateFrameBuffer(void);
   void CreateImageView(void);
   void CreateCommandBuffer(void);
+  void CreateSyncObjects(void);
+  void CreateTransientRing(void);
+  void CreateFrameDescriptors(void);
+  bool IsQueueing(void) const { return deferredMode || indirectMode || recordingThreads > 1 || depthPrePass; }
+  bool UseIndirectCommands(void) const { return indirectMode && indirectFirstInstance; }
+  // Subpass the color pipelines and queued draws render in
+  uint32_t ColorSubpass(void) const { return depthPrePass ? 1 : 0; }
+  void QueueDraw(queuedDraw draw);
+  uint64_t BuildSortKey(queuedDraw const& draw, uint32_t meshId, glm::mat4x4 const& viewProjection);
+  void FlushDrawQueue(void);
+  void RecordQueue(size_t count, bool depthOnly);
+  void RecordDrawRange(VkCommandBuffer buffer, size_t begin, size_t end, bool depthOnly);
+  void RecordSecondary(VkCommandBuffer buffer, size_t begin, size_t end, bool depthOnly);
+  void CreateRecordingPools(void);
+  void SetViewportState(VkCommandBuffer buffer);
+  bufferInfo CreateHostBuffer(VkDeviceSize size, VkBufferUsageFlags usage, void** mapped);
+  // Host cached where available, for data the CPU reads back
+  bufferInfo CreateReadbackBuffer(VkDeviceSize size, void** mapped);
+  ringAllocation AllocateTransient(VkDeviceSize size, VkDeviceSize alignment);
+  // Mapped buffer usable like the transient ring, released once the current frame completes
+  bufferInfo CreateTransientBuffer(VkDeviceSize size, VkDeviceSize alignment);
+  // Room for count PackedVertex, whole vertex aligned when queueing so draws can address the ring with vertexOffset
+  ringAllocation AllocateVertices(size_t count);
+  void DrawTransient(ringAllocation const& vertexes, uint32_t vertexCount, uint32_t instanceCount);
+  void DrawIndexedTransient(ringAllocation const& vertexes, size_t vertexCount, std::span<const uint32_t> indexes, uint32_t instanceCount);
+  // Binds the position stream only for depth only passes, every stream otherwise
+  void BindVertexStreams(VkCommandBuffer buffer, vertexBinding const& binding, bool positionOnly);
   void CreateGraphicsPipeline(void);
-  void UpdatePushConstants(void);
+  pipelineDesc GetPipelineDesc(PipelineVariant variant);
+  VkPipeline CreatePipeline(pipelineDesc const& desc, std::span<const VkPipelineShaderStageCreateInfo> shaders, VkPrimitiveTopology topology, bool blended, VkPipeline parent);
+  void FinishPipelineBuild(void);
+  VkPipeline GetPipeline(PipelineVariant variant, bool blended, TopoClass topology);
+  // Binds the pipeline for the active variant and topology class if it isn't already
+  void BindPipeline(void);
+  void PushDrawConstants(void);
+  void UpdateCameraMatrices(void);
+  // Camera and light of the frame, read by the GPU when it runs the frame
+  void WriteFrameUniforms(frameData& frame);
   void ReleaseActiveBuffers(void);
+  // Destroys the released static buffers the GPU is done with, or all of them
+  void ReleaseRetiredBuffers(bool all);
   void TransitionImage(uint32_t image, VkImageLayout old, VkImageLayout newL);
   void EndSingleBuffer(VkCommandBuffer buffer);
   void CommitBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
@@ -177,8 +587,8 @@ private:
   VkPipelineViewportStateCreateInfo CreateViewPortState(void);
   VkPipelineRasterizationStateCreateInfo CreateaRasterizationState(void);
   VkPipelineMultisampleStateCreateInfo CreateMultiSampleInfo(void);
-  VkPipelineColorBlendStateCreateInfo CreateColorBlendState(void);
-  VkPipelineDepthStencilStateCreateInfo CreateDepthStencilStat(void);
+  VkPipelineColorBlendStateCreateInfo CreateColorBlendState(bool blended);
+  VkPipelineDepthStencilStateCreateInfo CreateDepthStencilStat(pipelineDesc const& desc, bool blended);
   VkDescriptorSetLayout CreateDescriptorSetLayout(void);
   VkDescriptorPool CreateDescriptorPool(VkDescriptorSetLayout* setLayout);
   VkPipelineLayout CreatePipelineLayout(VkDescriptorSetLayout* setLayout);
@@ -187,19 +597,6 @@ private:
   bool isDeviceSuitable(VkPhysicalDevice device) {
     return true;
   }
-  static std::vector<char> readShaderFile(std::string path)
-  {
-    std::ifstream read(path, std::ios_base::binary | std::ios_base::ate);
-    if (read.is_open() == false)
-      throw std::runtime_error("Failed to open shader file");
-
-    size_t fileSize = static_cast<size_t>(read.tellg());
-    std::vector<char> buffer(fileSize);
-    read.seekg(0);
-    read.read(buffer.data(), fileSize);
-    read.close();
-    return buffer;
-  }
 
 
 };
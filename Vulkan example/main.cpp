@@ -40,6 +40,8 @@
 #include <SDL2/SDL_vulkan.h>
 #include "Vulkan Interface.h"
 #include "MeshData.h"
+#include "CpuProfiler.h"
+#include "TransformHierarchy.h"
 
 
 
@@ -121,10 +123,30 @@ std::vector<Vertex> points = {
 };
 
 
-int main()
+int main(int argc, char** argv)
 {
+  // Run by the post-build step: --pack-shaders <pack> <spv files...> writes the shader pack and exits
+  if (argc > 2 && std::string(argv[1]) == "--pack-shaders")
+  {
+    std::vector<std::string> files(argv + 3, argv + argc);
+    return ShaderRegistry::WritePack(argv[2], files) ? 0 : 1;
+  }
   VulkanInterface interface = VulkanInterface();
+  // --headless renders a fixed number of frames offscreen, for machines without a display.
+  // --profile prints frame phase percentiles on stdout every 600 frames
+  bool headless = false;
+  bool profile = false;
+  for (int i = 1; i < argc; ++i)
+  {
+    headless |= std::string(argv[i]) == "--headless";
+    profile |= std::string(argv[i]) == "--profile";
+  }
+  int headlessFrames = 300;
+  if (headless)
+    interface.SetHeadless(1280, 720);
   interface.Initialize();
+  if (profile)
+    CpuProfiler::Get().SetPeriodicDump(600, "");
   Camera& activeCam = interface.GetCamera();
   // Poll for user input
   Mesh m(6);
@@ -145,6 +167,16 @@ int main()
   plane.AddVertex({ {-.5f, 0,-.5f}, {1, 1, 1, 1} });
   plane.AddVertex({ { .5f, 0,-.5f}, {1, 1, 1, 1} });
   plane.CalculateNormals();
+  // Share the corners of each face, 36 vertices become 24 plus 16 bit indices
+  cube.Weld();
+  plane.Weld();
+  // Neither ever changes, upload them once instead of every frame
+  cube.MakeResident();
+  plane.MakeResident();
+  // Neither moves, their world matrices are worked out by the first Update and never again
+  TransformHierarchy scene;
+  uint32_t mNode = scene.Create({ { 0, 0, 5 }, { 0,0,0 }, { 1,1,1 } });
+  uint32_t planeNode = scene.Create({ { 0, -5, 0 }, { 0,0,0 }, { 1000,1,1000 } });
   bool stillRunning = true;
   float angle = 45.0f;
   float posX = -3;
@@ -157,22 +189,25 @@ int main()
   float ltime = 0;
   while (stillRunning) {
 
-    interface.BeginRenderPass();
+    // Only fails while minimized with a quit pending
+    if (interface.BeginRenderPass() == false)
+      break;
     activeCam.RotateCamera(glm::vec3(0, 0, 45));
     //vkCmdDraw(c, 3, 1, 0, 0);
-    interface.UpdateModelMatrix({ 0, 0, 5 }, { 0,0,0 }, { 1,1,1 });
+    scene.Update();
+    interface.SetModelTransform(scene.GetWorld(mNode));
     m.Draw();
-    interface.UpdateModelMatrix({ 0, -5, 0 }, { 0,0,0 }, { 1000,1,1000 });
+    interface.SetModelTransform(scene.GetWorld(planeNode));
     plane.Draw();
     interface.SetTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-    interface.UpdateModelMatrix({ posX, posY, 10 }, { 0,0,0 }, { .25f, .25f, .25f });
-    cube.Draw();
-    interface.UpdateModelMatrix({ -3, 7, 30 }, { 0,0,0 }, { 2.5, 1, 3 });
-    cube.Draw();
-    interface.UpdateModelMatrix({ -30, 7, 100 }, { 0,0,0 }, { 2.5, 2.5, 2.5 });
-    cube.Draw();
-    interface.UpdateModelMatrix(lightPos, { angle,0,0 }, { 1,  1, 1 });
-    cube.Draw();
+    // Every cube in one draw call
+    std::array<Transform, 4> cubes = { {
+      { { posX, posY, 10 }, { 0,0,0 }, { .25f, .25f, .25f } },
+      { { -3, 7, 30 }, { 0,0,0 }, { 2.5, 1, 3 } },
+      { { -30, 7, 100 }, { 0,0,0 }, { 2.5, 2.5, 2.5 } },
+      { lightPos, { angle,0,0 }, { 1,  1, 1 } },
+    } };
+    interface.DrawInstanced(cube, cubes);
     interface.SetLightStrength(lightStregnth);
     interface.SetLightPosition(glm::vec4(lightPos, 1));
     lightPos.x = 15 * glm::cos(ltime/10);
@@ -193,6 +228,13 @@ int main()
 
     interface.EndRenderPass();
 
+    if (headless)
+    {
+      stillRunning = --headlessFrames > 0;
+      ltime += 1 / 10.0f;
+      continue;
+    }
+
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
 
@@ -205,6 +247,11 @@ int main()
       case SDL_KEYDOWN:
 
         break;
+      case SDL_WINDOWEVENT:
+        // Not every platform reports a resize through the swapchain
+        if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+          interface.OnWindowResized();
+        break;
       default:
         // Do nothing.
         break;